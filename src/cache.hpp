@@ -0,0 +1,269 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "stats.hpp"
+#include "util/fd.hpp"
+#include "util/string-map.hpp"
+
+// identifies the content of a source file
+// a cached phantom file is valid as long as its source has the same identity
+struct SourceIdentity {
+    dev_t    dev;
+    ino_t    ino;
+    timespec mtime;
+    off_t    size;
+
+    auto operator==(const SourceIdentity& o) const -> bool {
+        return dev == o.dev && ino == o.ino && mtime.tv_sec == o.mtime.tv_sec && mtime.tv_nsec == o.mtime.tv_nsec && size == o.size;
+    }
+
+    SourceIdentity(const struct stat& st) : dev(st.st_dev), ino(st.st_ino), mtime(st.st_mtim), size(st.st_size) {}
+};
+
+struct CachedFile {
+    FileDescriptor fd;
+    size_t         size;
+    SourceIdentity source;
+};
+
+// decoded phantom files, bounded by a byte budget
+// an entry is pinned while someone other than the cache holds its CachedFile
+// entries are split into shards by path hash, each behind its own mutex, so that accesses to different files do not contend
+// the budget is shared, and eviction visits the shards one at a time
+class DecodedCache {
+  private:
+    struct Entry {
+        std::shared_ptr<CachedFile> file;
+        uint64_t                    last_access;
+    };
+
+    struct Shard {
+        std::mutex       mutex;
+        StringMap<Entry> entries;
+    };
+
+    constexpr static auto shard_count = size_t(16);
+
+    std::array<Shard, shard_count> shards;
+    std::atomic_size_t             budget     = size_t(1) << 30; // 1GiB
+    std::atomic_size_t             total_size = 0;
+    std::atomic_uint64_t           clock      = 0;
+    std::mutex                     shrink_mutex; // one evictor at a time
+
+    static auto is_pinned(const Entry& entry) -> bool {
+        return entry.file.use_count() > 1;
+    }
+
+    auto get_shard(const std::string_view path) -> Shard& {
+        return shards[std::hash<std::string_view>()(path) % shard_count];
+    }
+
+    // also measures how long callers wait for each other
+    static auto lock_shard(Shard& shard) -> std::unique_lock<std::mutex> {
+        auto lock = std::unique_lock(shard.mutex, std::try_to_lock);
+        if(!lock.owns_lock()) {
+            const auto begin = std::chrono::steady_clock::now();
+            lock.lock();
+            const auto wait = std::chrono::steady_clock::now() - begin;
+            stats.cache_lock_waits += 1;
+            stats.cache_lock_wait_us += std::chrono::duration_cast<std::chrono::microseconds>(wait).count();
+        }
+        return lock;
+    }
+
+    auto tick() -> uint64_t {
+        return clock.fetch_add(1) + 1;
+    }
+
+    // prefer entries which are both old and large
+    auto eviction_score(const Entry& entry, const uint64_t now) const -> double {
+        return double(now - std::min(now, entry.last_access) + 1) * double(entry.file->size);
+    }
+
+    auto erase_entry(StringMap<Entry>& entries, const StringMap<Entry>::iterator p) -> void {
+        total_size -= p->second.file->size;
+        entries.erase(p);
+    }
+
+    // shrink_mutex must be held
+    // one pass over the shards chooses as many victims as needed to free excess bytes
+    auto evict(const size_t excess) -> bool {
+        struct Victim {
+            size_t      shard;
+            std::string path;
+            double      score;
+            size_t      size;
+        };
+
+        const auto now     = clock.load();
+        auto       victims = std::vector<Victim>();
+        for(auto i = size_t(0); i < shard_count; i += 1) {
+            const auto lock = lock_shard(shards[i]);
+            for(const auto& [path, entry] : shards[i].entries) {
+                if(!is_pinned(entry)) {
+                    victims.push_back(Victim{i, path, eviction_score(entry, now), entry.file->size});
+                }
+            }
+        }
+        if(victims.empty()) {
+            return false;
+        }
+
+        std::sort(victims.begin(), victims.end(), [](const Victim& a, const Victim& b) { return a.score > b.score; });
+        auto count = size_t(0);
+        for(auto freed = size_t(0); count < victims.size() && freed < excess; count += 1) {
+            freed += victims[count].size;
+        }
+        victims.resize(count);
+
+        // victims may have been opened or replaced since they were chosen, in which case the next pass picks others
+        std::sort(victims.begin(), victims.end(), [](const Victim& a, const Victim& b) { return a.shard < b.shard; });
+        auto lock = std::unique_lock<std::mutex>();
+        for(auto i = size_t(0); i < victims.size(); i += 1) {
+            auto& shard = shards[victims[i].shard];
+            if(i == 0 || victims[i].shard != victims[i - 1].shard) {
+                if(lock) {
+                    lock.unlock();
+                }
+                lock = lock_shard(shard);
+            }
+            const auto p = shard.entries.find(victims[i].path);
+            if(p != shard.entries.end() && !is_pinned(p->second)) {
+                erase_entry(shard.entries, p);
+            }
+        }
+        return true;
+    }
+
+  public:
+    // entries generated from another version of the source are dropped
+    auto find(const std::string_view path, const SourceIdentity& source) -> std::shared_ptr<CachedFile> {
+        auto&      shard = get_shard(path);
+        const auto lock  = lock_shard(shard);
+        const auto p     = shard.entries.find(path);
+        if(p == shard.entries.end()) {
+            return nullptr;
+        }
+        if(!(p->second.file->source == source)) {
+            erase_entry(shard.entries, p);
+            return nullptr;
+        }
+        p->second.last_access = tick();
+        return p->second.file;
+    }
+
+    // takes ownership of fd
+    // if another file is already cached for the path, it is returned instead
+    auto insert(const std::string_view path, FileDescriptor fd, const SourceIdentity& source) -> std::shared_ptr<CachedFile> {
+        struct stat st;
+        if(fstat(fd.as_handle(), &st) == -1) {
+            return nullptr;
+        }
+
+        auto file = std::shared_ptr<CachedFile>(new CachedFile{std::move(fd), size_t(st.st_size), source});
+        {
+            auto&      shard = get_shard(path);
+            const auto lock  = lock_shard(shard);
+            if(const auto p = shard.entries.find(path); p != shard.entries.end()) {
+                if(p->second.file->source == source) {
+                    p->second.last_access = tick();
+                    return p->second.file;
+                }
+                erase_entry(shard.entries, p);
+            }
+            shard.entries.emplace(path, Entry{file, tick()});
+            total_size += file->size;
+        }
+        shrink();
+        return file;
+    }
+
+    auto erase(const std::string_view path) -> bool {
+        auto&      shard = get_shard(path);
+        const auto lock  = lock_shard(shard);
+        const auto p     = shard.entries.find(path);
+        if(p == shard.entries.end()) {
+            return false;
+        }
+        erase_entry(shard.entries, p);
+        return true;
+    }
+
+    // opened files stay valid until released
+    // pinned entries are skipped, so the cache may stay over budget until they are released
+    // takes no lock while the cache is within the budget
+    auto shrink() -> void {
+        if(total_size <= budget) {
+            return;
+        }
+        const auto lock = std::lock_guard(shrink_mutex);
+        while(true) {
+            const auto size  = total_size.load();
+            const auto limit = budget.load();
+            if(size <= limit || !evict(size - limit)) {
+                break;
+            }
+        }
+    }
+
+    auto get_total_size() const -> size_t {
+        return total_size;
+    }
+
+    auto get_budget() const -> size_t {
+        return budget;
+    }
+
+    auto set_budget(const size_t new_budget) -> void {
+        budget = new_budget;
+        shrink();
+    }
+};
+
+// sizes of phantom files which were decoded at least once
+// lets getattr answer without decoding them again after eviction
+class SizeCache {
+  private:
+    constexpr static auto max_entries = size_t(1) << 16;
+
+    struct Entry {
+        size_t         size;
+        SourceIdentity source;
+    };
+
+    StringMap<Entry> sizes;
+
+  public:
+    auto find(const std::string_view path, const SourceIdentity& source) const -> std::optional<size_t> {
+        const auto p = sizes.find(path);
+        if(p == sizes.end() || !(p->second.source == source)) {
+            return std::nullopt;
+        }
+        return p->second.size;
+    }
+
+    auto insert(const std::string_view path, const size_t size, const SourceIdentity& source) -> void {
+        if(sizes.size() >= max_entries) {
+            sizes.clear();
+        }
+        erase(path);
+        sizes.emplace(path, Entry{size, source});
+    }
+
+    auto erase(const std::string_view path) -> void {
+        if(const auto p = sizes.find(path); p != sizes.end()) {
+            sizes.erase(p);
+        }
+    }
+};
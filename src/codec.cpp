@@ -1,8 +1,13 @@
+#include <chrono>
+
 #include "drivers/flac/flac-to-wav.hpp"
 #include "drivers/jxl/bmp-encoder.hpp"
+#include "drivers/jxl/bmp-stream.hpp"
 #include "drivers/jxl/jpg-encoder.hpp"
 #include "drivers/jxl/jxl-decoder.hpp"
+#include "drivers/jxl/jxl-to-bmp.hpp"
 #include "drivers/jxl/png-encoder.hpp"
+#include "drivers/jxl/swizzle.hpp"
 #include "util/charconv.hpp"
 
 template <class T>
@@ -29,14 +34,25 @@ class CPUTimer {
     }
 };
 
+template <class F>
+auto measure_seconds(F function) -> double {
+    const auto begin = std::chrono::steady_clock::now();
+    function();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+}
+
+auto print_throughput(const char* const label, const size_t bytes, const double seconds) -> void {
+    printf("%s: %.1fMB/s (%zu bytes in %.3fs)\n", label, bytes / seconds / 1000 / 1000, bytes, seconds);
+}
+
 auto save_fd_to_file(const int fd, const char* const path) -> bool {
     const auto size = get_fd_size(fd);
     if(size == -1) {
         return false;
     }
     auto buf = std::vector<std::byte>(size);
-    if(read(fd, buf.data(), buf.size()) != size) {
-        printf("read() failed %d\n", errno);
+    if(pread(fd, buf.data(), buf.size(), 0) != size) {
+        printf("pread() failed %d\n", errno);
         return false;
     }
     auto ofs = std::ofstream(path);
@@ -93,7 +109,7 @@ auto main(const int argc, const char* const argv[]) -> int {
         auto c     = 0;
         auto timer = CPUTimer();
         while(c++ < 50) {
-            const auto jpg = drivers::jxl::encode_jpg(argv[3], image.as_value(), quality);
+            const auto jpg = drivers::jxl::encode_jpg(argv[3], image.as_value(), {.quality = quality});
             do_not_optimize(jpg);
         }
     } else if(mode == "d") { // png encoder test
@@ -136,6 +152,217 @@ auto main(const int argc, const char* const argv[]) -> int {
             puts("save failed");
             return 1;
         }
+    } else if(mode == "g") { // flac to wav speed test
+        const auto iterations = from_chars<int>(argv[3]);
+        if(!iterations) {
+            puts("invalid argument");
+            return 1;
+        }
+
+        auto bytes   = size_t(0);
+        auto ok      = true;
+        auto elapsed = measure_seconds([&]() {
+            for(auto i = 0; i < *iterations && ok; i += 1) {
+                const auto wav = FileDescriptor(drivers::flac::flac_to_wav(argv[2]));
+                if(!wav) {
+                    ok = false;
+                    break;
+                }
+                bytes += get_fd_size(wav.as_handle());
+            }
+        });
+        if(!ok) {
+            puts("flac to wav convert failed");
+            return 1;
+        }
+        print_throughput("decode", bytes, elapsed);
+    } else if(mode == "h") { // pcm interleave speed test, per-sample fwrite vs pack_pcm
+        const auto channels = from_chars<uint32_t>(argv[2]);
+        const auto bps      = from_chars<uint32_t>(argv[3]);
+        if(!channels || !bps || *channels == 0 || *bps % 8 != 0 || *bps == 0 || *bps > 32) {
+            puts("invalid argument");
+            return 1;
+        }
+
+        constexpr auto blocksize = 4096;
+        constexpr auto blocks    = 2048;
+
+        auto planes = std::vector<std::vector<FLAC__int32>>(*channels, std::vector<FLAC__int32>(blocksize));
+        auto buffer = std::vector<const FLAC__int32*>();
+        for(auto& plane : planes) {
+            for(auto i = 0; i < blocksize; i += 1) {
+                plane[i] = FLAC__int32((i * 7919 + 13) % (int64_t(1) << (*bps - 1)));
+            }
+            buffer.push_back(plane.data());
+        }
+        const auto bytes = size_t(blocks) * blocksize * *channels * (*bps / 8);
+
+        {
+            auto file    = open_memory_file<OpenMode::Write>("reference");
+            auto elapsed = measure_seconds([&]() {
+                for(auto b = 0; b < blocks; b += 1) {
+                    for(auto i = 0; i < blocksize; i += 1) {
+                        for(auto c = uint32_t(0); c < *channels; c += 1) {
+                            fwrite(&buffer[c][i], *bps / 8, 1, file.get());
+                        }
+                    }
+                }
+                fflush(file.get());
+            });
+            print_throughput("per-sample fwrite", bytes, elapsed);
+        }
+        {
+            auto file    = open_memory_file<OpenMode::Write>("packed");
+            auto frame   = std::vector<std::byte>(blocksize * *channels * (*bps / 8));
+            auto elapsed = measure_seconds([&]() {
+                for(auto b = 0; b < blocks; b += 1) {
+                    drivers::flac::pack_pcm(frame.data(), buffer.data(), blocksize, *channels, *bps);
+                    fwrite(frame.data(), frame.size(), 1, file.get());
+                }
+                fflush(file.get());
+            });
+            print_throughput("pack_pcm", bytes, elapsed);
+        }
+    } else if(mode == "i") { // jxl to bmp direct decode test, output should match "e"
+        const auto bmp = drivers::jxl::decode_jxl_to_bmp(argv[2]);
+        if(!bmp) {
+            puts(bmp.as_error().cstr());
+            return 1;
+        }
+        if(!save_fd_to_file(bmp.as_value().as_handle(), argv[3])) {
+            puts("save failed");
+            return 1;
+        }
+    } else if(mode == "j") { // rgba to bgra swizzle speed test, scalar vs dispatched kernel
+        const auto megapixels = from_chars<size_t>(argv[2]);
+        const auto iterations = from_chars<int>(argv[3]);
+        if(!megapixels || !iterations || *megapixels == 0) {
+            puts("invalid argument");
+            return 1;
+        }
+
+        const auto pixels = *megapixels * 1000 * 1000;
+        auto       src    = std::vector<std::byte>(pixels * 4);
+        auto       dst    = std::vector<std::byte>(pixels * 4);
+        for(auto i = size_t(0); i < src.size(); i += 1) {
+            src[i] = std::byte(i * 7 + 3);
+        }
+        const auto bytes = src.size() * *iterations;
+
+        const auto print = [bytes](const char* const label, const double seconds) {
+            printf("%s: %.2fGB/s\n", label, bytes / seconds / 1000 / 1000 / 1000);
+        };
+        print("scalar", measure_seconds([&]() {
+                  for(auto i = 0; i < *iterations; i += 1) {
+                      drivers::jxl::swizzle::rgba_to_bgra_scalar(dst.data(), src.data(), pixels);
+                      do_not_optimize(dst.data());
+                  }
+              }));
+        const auto reference = dst;
+        print("dispatched", measure_seconds([&]() {
+                  for(auto i = 0; i < *iterations; i += 1) {
+                      drivers::jxl::rgba_to_bgra(dst.data(), src.data(), pixels);
+                      do_not_optimize(dst.data());
+                  }
+              }));
+        if(dst != reference) {
+            puts("result mismatch");
+            return 1;
+        }
+    } else if(mode == "k") { // bmp stream test, header read vs whole file read, output should match "i"
+        auto stream = drivers::jxl::BmpStream();
+        if(!stream.init(argv[2])) {
+            puts("stream init failed");
+            return 1;
+        }
+
+        auto buf = std::vector<std::byte>(stream.get_size());
+        auto ok  = true;
+        printf("header: %.3fms\n", 1000 * measure_seconds([&]() {
+                   ok = stream.read(buf.data(), sizeof(drivers::jxl::BitmapHeaders), 0) == sizeof(drivers::jxl::BitmapHeaders);
+               }));
+        printf("whole: %.3fms\n", 1000 * measure_seconds([&]() {
+                   constexpr auto chunk = size_t(128) * 1024;
+                   for(auto offset = size_t(0); ok && offset < buf.size(); offset += chunk) {
+                       ok = stream.read(buf.data() + offset, std::min(chunk, buf.size() - offset), offset) != -1;
+                   }
+               }));
+        if(!ok) {
+            puts("read failed");
+            return 1;
+        }
+        auto ofs = std::ofstream(argv[3]);
+        ofs.write(std::bit_cast<const char*>(buf.data()), buf.size());
+    } else if(mode == "l") { // png profile test, encode time and size of each profile
+        const auto image      = drivers::jxl::decode_jxl<4>(argv[2]);
+        const auto iterations = from_chars<int>(argv[3]);
+        if(!image) {
+            puts(image.as_error().cstr());
+            return 1;
+        }
+        if(!iterations || *iterations <= 0) {
+            puts("invalid argument");
+            return 1;
+        }
+
+        using drivers::jxl::PngProfile;
+        for(const auto profile : {PngProfile::Fastest, PngProfile::Balanced, PngProfile::Smallest}) {
+            for(const auto parallel : {false, true}) {
+                auto size    = ssize_t(-1);
+                auto elapsed = measure_seconds([&]() {
+                    for(auto i = 0; i < *iterations; i += 1) {
+                        const auto png = FileDescriptor(drivers::jxl::encode_png("encoded", image.as_value(), {profile, parallel}));
+                        size           = png ? get_fd_size(png.as_handle()) : -1;
+                    }
+                });
+                if(size == -1) {
+                    puts("png encode failed");
+                    return 1;
+                }
+                printf("%s%s: %.1fms, %zd bytes\n", drivers::jxl::get_png_profile_name(profile), parallel ? " parallel" : "", 1000 * elapsed / *iterations, size);
+            }
+        }
+    } else if(mode == "m") { // png write syscall test, buffered output vs one write() per libpng chunk
+        const auto image      = drivers::jxl::decode_jxl<4>(argv[2]);
+        const auto iterations = from_chars<int>(argv[3]);
+        if(!image) {
+            puts(image.as_error().cstr());
+            return 1;
+        }
+        if(!iterations || *iterations <= 0) {
+            puts("invalid argument");
+            return 1;
+        }
+
+        auto encoded = std::vector<std::byte>();
+        auto elapsed = measure_seconds([&]() {
+            for(auto i = 0; i < *iterations; i += 1) {
+                const auto png = FileDescriptor(drivers::jxl::encode_png("encoded", image.as_value()));
+                if(png && i + 1 == *iterations) {
+                    encoded.resize(get_fd_size(png.as_handle()));
+                    encoded.resize(std::max(pread(png.as_handle(), encoded.data(), encoded.size(), 0), ssize_t(0)));
+                }
+            }
+        });
+        if(encoded.empty()) {
+            puts("png encode failed");
+            return 1;
+        }
+        const auto chunks = stats.png_chunks / *iterations;
+        const auto writes = stats.png_writes / *iterations;
+        printf("buffered: %.3fms per encode, %zu write() calls\n", 1000 * elapsed / *iterations, writes);
+
+        // replays the same amount of output in as many write() calls as libpng emitted chunks
+        const auto piece = (encoded.size() + chunks - 1) / chunks;
+        elapsed          = measure_seconds([&]() {
+            for(auto i = 0; i < *iterations; i += 1) {
+                auto file = open_memory_fd("replay");
+                for(auto offset = size_t(0); offset < encoded.size(); offset += piece) {
+                    file.write(encoded.data() + offset, std::min(piece, encoded.size() - offset));
+                }
+            }
+        });
+        printf("per-chunk write(): +%.3fms per encode, %zu write() calls\n", 1000 * elapsed / *iterations, chunks);
     } else {
         puts("unknown mode");
         return 0;
@@ -0,0 +1,145 @@
+#pragma once
+#include <algorithm>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cache.hpp"
+#include "util/fd.hpp"
+
+// generated phantom files persisted in a directory, so that they survive remounts
+// files are named after the identity of their source, so a modified source never hits
+class DiskCache {
+  private:
+    std::string dir;
+    size_t      limit;
+    std::mutex  mutex; // guards total_size and collection
+    size_t      total_size = 0;
+
+    // removes least recently used files until the cache shrinks to 3/4 of the limit
+    // hits refresh mtime, so it is used as the access time
+    auto collect() -> void {
+        struct Item {
+            std::filesystem::path path;
+            timespec              mtime;
+            size_t                size;
+        };
+
+        auto items = std::vector<Item>();
+        auto error = std::error_code();
+        for(const auto& entry : std::filesystem::directory_iterator(dir, error)) {
+            if(entry.path().filename().string().starts_with(".tmp.")) {
+                continue; // being stored
+            }
+            struct stat st;
+            if(::stat(entry.path().c_str(), &st) == -1 || !S_ISREG(st.st_mode)) {
+                continue;
+            }
+            items.push_back(Item{entry.path(), st.st_mtim, size_t(st.st_size)});
+        }
+        std::sort(items.begin(), items.end(), [](const Item& a, const Item& b) {
+            return a.mtime.tv_sec != b.mtime.tv_sec ? a.mtime.tv_sec < b.mtime.tv_sec : a.mtime.tv_nsec < b.mtime.tv_nsec;
+        });
+
+        total_size = 0;
+        for(const auto& item : items) {
+            total_size += item.size;
+        }
+        if(total_size <= limit) {
+            return;
+        }
+        for(const auto& item : items) {
+            if(total_size <= limit / 4 * 3) {
+                break;
+            }
+            if(::unlink(item.path.c_str()) == 0) {
+                total_size -= item.size;
+            }
+        }
+    }
+
+  public:
+    // dev + inode + mtime + size of the source, driver version and phantom extension, hashed with fnv-1a
+    static auto make_key(const SourceIdentity& source, const std::string_view version, const std::string_view phantom_path) -> std::string {
+        const auto extension = std::filesystem::path(phantom_path).extension().string();
+        const auto identity  = std::to_string(source.dev) + ":" + std::to_string(source.ino) + ":" +
+                              std::to_string(source.mtime.tv_sec) + "." + std::to_string(source.mtime.tv_nsec) + ":" +
+                              std::to_string(source.size) + ":" + std::string(version) + ":" + extension;
+
+        auto hash = uint64_t(0xcbf29ce484222325);
+        for(const auto c : identity) {
+            hash = (hash ^ uint8_t(c)) * 0x100000001b3;
+        }
+
+        auto key = std::string(16, '0');
+        snprintf(key.data(), key.size() + 1, "%016llx", (unsigned long long)hash);
+        return key + extension;
+    }
+
+    auto open(const std::string_view key) -> FileDescriptor {
+        const auto path = dir + "/" + std::string(key);
+        auto       fd   = FileDescriptor(::open(path.data(), O_RDONLY));
+        if(fd) {
+            futimens(fd.as_handle(), NULL);
+        }
+        return fd;
+    }
+
+    // copies fd into the cache, without moving its file offset
+    auto store(const std::string_view key, const int fd, const size_t size) -> bool {
+        auto temp_path = dir + "/.tmp.XXXXXX";
+        auto temp      = FileDescriptor(mkstemp(temp_path.data()));
+        if(!temp) {
+            return false;
+        }
+
+        auto offset = off_t(0);
+        while(size_t(offset) < size) {
+            if(sendfile(temp.as_handle(), fd, &offset, size - offset) <= 0) {
+                ::unlink(temp_path.data());
+                return false;
+            }
+        }
+        const auto path = dir + "/" + std::string(key);
+        if(::rename(temp_path.data(), path.data()) == -1) {
+            ::unlink(temp_path.data());
+            return false;
+        }
+
+        const auto lock = std::lock_guard(mutex);
+        total_size += size;
+        if(total_size > limit) {
+            collect();
+        }
+        return true;
+    }
+
+    auto init() -> bool {
+        auto error = std::error_code();
+        std::filesystem::create_directories(dir, error);
+        if(error) {
+            return false;
+        }
+
+        // leftovers of interrupted stores
+        for(const auto& entry : std::filesystem::directory_iterator(dir, error)) {
+            if(entry.path().filename().string().starts_with(".tmp.")) {
+                std::filesystem::remove(entry.path(), error);
+            }
+        }
+
+        const auto lock = std::lock_guard(mutex);
+        collect();
+        return true;
+    }
+
+    DiskCache(std::string dir, const size_t limit) : dir(std::move(dir)), limit(limit) {}
+};
@@ -1,11 +1,48 @@
 #pragma once
 #include <concepts>
+#include <cstddef>
+#include <memory>
 #include <optional>
+#include <string>
+#include <string_view>
 #include <vector>
 
+#include <sys/types.h>
+
+#include "util/fd.hpp"
+
+// phantom file which is produced piece by piece on read, instead of being decoded as a whole on open
+class PhantomStream {
+  public:
+    virtual auto get_size() const -> size_t = 0;
+
+    // returns number of bytes read, or -1 with errno
+    virtual auto read(std::byte* buffer, size_t size, size_t offset) -> ssize_t = 0;
+
+    // streams which keep their whole output may be shared by opens of the same file
+    // others keep per-open state, such as a decode position
+    virtual auto is_shareable() const -> bool {
+        return false;
+    }
+
+    // the whole file, if every byte of it has been produced, so that it can be cached like a decoded one
+    // called once, after the last read
+    virtual auto take_file() -> FileDescriptor {
+        return FileDescriptor();
+    }
+
+    virtual ~PhantomStream() {}
+};
+
+// path arguments always have one of the declared extensions, real ones for get_phantom_paths and phantom ones for the others
 template <class T>
 concept Driver = requires(const T& driver) {
+                     { T::source_extension } -> std::convertible_to<std::string_view>; // ".jxl"
+                     { T::phantom_extensions.size() } -> std::convertible_to<size_t>;  // {".jpg", ".png"}, each extension belongs to one driver
+                     { driver.get_version("/tmp/image.png") } -> std::same_as<std::string>; // changes whenever the phantom file may change
                      { driver.get_real_path("/tmp/image.jpg") } -> std::same_as<std::optional<std::string>>;                  // "/tmp/image.jxl"
                      { driver.get_phantom_paths("/tmp/image.jxl") } -> std::same_as<std::optional<std::vector<std::string>>>; // ["/tmp/image.jpg", "/tmp/image.png"]
                      { driver.open_phantom_file("/tmp/image.jpg") } -> std::same_as<std::optional<int>>;
+                     { driver.open_phantom_stream("/tmp/audio.wav") } -> std::same_as<std::unique_ptr<PhantomStream>>; // null if streaming is not supported
+                     { driver.get_phantom_file_size("/tmp/image.bmp") } -> std::same_as<std::optional<size_t>>;         // only if it is known without decoding
                  };
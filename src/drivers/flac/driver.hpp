@@ -1,20 +1,25 @@
 #pragma once
+#include <array>
 #include <filesystem>
 #include <string_view>
 
 #include "../../driver.hpp"
 #include "flac-to-wav.hpp"
+#include "wav-stream.hpp"
 
 namespace drivers::flac {
 class Driver {
   private:
   public:
-    auto get_real_path(const std::string_view path_str) const -> std::optional<std::string> {
-        if(!path_str.ends_with(".wav")) {
-            return std::nullopt;
-        }
+    constexpr static auto source_extension   = std::string_view(".flac");
+    constexpr static auto phantom_extensions = std::array<std::string_view, 1>{".wav"};
+
+    auto get_version(const std::string_view /*path*/) const -> std::string {
+        return "flac-1";
+    }
 
-        auto real_path = std::filesystem::path(path_str).replace_extension(".flac");
+    auto get_real_path(const std::string_view path_str) const -> std::optional<std::string> {
+        auto real_path = std::filesystem::path(path_str).replace_extension(source_extension);
         if(!std::filesystem::exists(real_path)) {
             return std::nullopt;
         }
@@ -22,13 +27,9 @@ class Driver {
     }
 
     auto get_phantom_paths(const std::string_view path_str) const -> std::optional<std::vector<std::string>> {
-        if(!path_str.ends_with(".flac")) {
-            return std::nullopt;
-        }
-
         auto       files = std::vector<std::string>();
         const auto path  = std::filesystem::path(path_str);
-        for(const auto ext : {".wav"}) {
+        for(const auto ext : phantom_extensions) {
             auto file = std::filesystem::path(path).replace_extension(ext);
             files.emplace_back(file.string());
         }
@@ -54,6 +55,28 @@ class Driver {
 
         return -1;
     }
+
+    auto open_phantom_stream(const std::string_view path_str) const -> std::unique_ptr<PhantomStream> {
+        if(!path_str.ends_with(".wav")) {
+            return nullptr;
+        }
+
+        const auto real_path = std::filesystem::path(path_str).replace_extension(".flac");
+        auto       stream    = std::unique_ptr<WavStream>(new WavStream());
+        if(!stream->init(real_path.c_str())) {
+            return nullptr;
+        }
+        return stream;
+    }
+
+    auto get_phantom_file_size(const std::string_view path_str) const -> std::optional<size_t> {
+        if(!path_str.ends_with(".wav")) {
+            return std::nullopt;
+        }
+
+        const auto real_path = std::filesystem::path(path_str).replace_extension(".flac");
+        return wav_file_size(real_path.c_str());
+    }
 };
 
 static_assert(::Driver<Driver>);
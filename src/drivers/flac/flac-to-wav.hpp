@@ -1,10 +1,14 @@
 #pragma once
 #include <array>
+#include <optional>
+#include <vector>
 
 #include <FLAC++/decoder.h>
+#include <FLAC++/metadata.h>
 
 #include "../../memfd.hpp"
 #include "../../util/error.hpp"
+#include "pcm.hpp"
 
 namespace drivers::flac {
 struct RiffChunkHeader {
@@ -36,33 +40,51 @@ constexpr auto riff_id(const char (&str)[5]) -> std::array<char, 4> {
     return {str[0], str[1], str[2], str[3]};
 }
 
-class Decoder : public FLAC::Decoder::File {
-  private:
-    struct Metadata {
-        FLAC__uint64 total_samples;
-        uint32_t     sample_rate;
-        uint32_t     channels;
-        uint32_t     bps;
+struct PCMInfo {
+    FLAC__uint64 total_samples;
+    uint32_t     sample_rate;
+    uint32_t     channels;
+    uint32_t     bps;
+
+    auto get_block_align() const -> size_t {
+        return channels * (bps / 8);
+    }
+
+    auto get_pcm_size() const -> size_t {
+        return total_samples * get_block_align();
+    }
+
+    PCMInfo(const FLAC__StreamMetadata_StreamInfo& info)
+        : total_samples(info.total_samples),
+          sample_rate(info.sample_rate),
+          channels(info.channels),
+          bps(info.bits_per_sample) {}
+};
+
+inline auto make_wav_header(const PCMInfo& info) -> WavHeader {
+    const auto total_size = info.get_pcm_size();
+    return WavHeader{
+        .riff_header     = {riff_id("RIFF"), uint32_t(total_size + (sizeof(WavHeader) - sizeof(WavHeader::riff_header)))},
+        .riff_tag        = riff_id("WAVE"),
+        .wave_header     = {riff_id("fmt "), 16},
+        .format          = 1, // format = PCM
+        .channels        = uint16_t(info.channels),
+        .sample_rate     = info.sample_rate,
+        .bytes_per_sec   = uint32_t(info.sample_rate * info.get_block_align()),
+        .block_align     = uint16_t(info.get_block_align()),
+        .bits_per_sample = uint16_t(info.bps),
+        .data_header     = {riff_id("data"), uint32_t(total_size)},
     };
+}
 
-    std::optional<Metadata> metadata;
-    FILE*                   output;
-
-    auto write_wav_header(const Metadata& metadata) -> bool {
-        const auto total_size = metadata.total_samples * metadata.channels * (metadata.bps / 8);
-        const auto wav_header = WavHeader{
-            .riff_header     = {riff_id("RIFF"), uint32_t(total_size + (sizeof(WavHeader) - sizeof(WavHeader::riff_header)))},
-            .riff_tag        = riff_id("WAVE"),
-            .wave_header     = {riff_id("fmt "), 16},
-            .format          = 1, // format = PCM
-            .channels        = uint16_t(metadata.channels),
-            .sample_rate     = metadata.sample_rate,
-            .bytes_per_sec   = metadata.channels * metadata.channels * (metadata.bps / 8),
-            .block_align     = uint16_t(metadata.channels * (metadata.bps / 8)),
-            .bits_per_sample = uint16_t(metadata.bps),
-            .data_header     = {riff_id("data"), uint32_t(total_size)},
-        };
+class Decoder : public FLAC::Decoder::File {
+  private:
+    std::optional<PCMInfo> metadata;
+    FILE*                  output;
+    std::vector<std::byte> frame_buffer; // reused between frames
 
+    auto write_wav_header(const PCMInfo& metadata) -> bool {
+        const auto wav_header = make_wav_header(metadata);
         return fwrite(&wav_header, sizeof(WavHeader), 1, output) == 1;
     }
 
@@ -71,12 +93,12 @@ class Decoder : public FLAC::Decoder::File {
             return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
         }
 
-        for(auto i = uint32_t(0); i < frame->header.blocksize; i += 1) {
-            for(auto c = uint32_t(0); c < metadata->channels; c += 1) {
-                if(fwrite(&buffer[c][i], metadata->bps / 8, 1, output) != 1) {
-                    return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
-                }
-            }
+        frame_buffer.resize(frame->header.blocksize * metadata->get_block_align());
+        if(!pack_pcm(frame_buffer.data(), buffer, frame->header.blocksize, metadata->channels, metadata->bps)) {
+            return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
+        }
+        if(fwrite(frame_buffer.data(), frame_buffer.size(), 1, output) != 1) {
+            return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
         }
 
         return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
@@ -85,13 +107,7 @@ class Decoder : public FLAC::Decoder::File {
     auto metadata_callback(const FLAC__StreamMetadata* const metadata) -> void override {
         switch(metadata->type) {
         case FLAC__METADATA_TYPE_STREAMINFO: {
-            const auto& info = metadata->data.stream_info;
-            const auto  m    = Metadata{
-                    .total_samples = info.total_samples,
-                    .sample_rate   = info.sample_rate,
-                    .channels      = info.channels,
-                    .bps           = info.bits_per_sample,
-            };
+            const auto m = PCMInfo(metadata->data.stream_info);
             if(write_wav_header(m)) {
                 this->metadata = m;
             }
@@ -106,6 +122,15 @@ class Decoder : public FLAC::Decoder::File {
     Decoder(FILE* const output) : output(output) {}
 };
 
+// computed from STREAMINFO, without decoding any frame
+inline auto wav_file_size(const char* const path) -> std::optional<size_t> {
+    auto info = FLAC::Metadata::StreamInfo();
+    if(!FLAC::Metadata::get_streaminfo(path, info) || info.get_total_samples() == 0) {
+        return std::nullopt;
+    }
+    return sizeof(WavHeader) + info.get_total_samples() * info.get_channels() * (info.get_bits_per_sample() / 8);
+}
+
 inline auto flac_to_wav(const char* const path) -> int {
     auto input = File(fopen(path, "rb"));
     if(input == NULL) {
@@ -0,0 +1,110 @@
+#pragma once
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <FLAC++/decoder.h>
+
+namespace drivers::flac {
+// writes one sample as little-endian wav pcm
+template <int bytes>
+inline auto pack_sample(std::byte* const out, const FLAC__int32 sample) -> void {
+    if constexpr(bytes == 1) {
+        out[0] = std::byte(sample + 128); // 8-bit wav is unsigned
+    } else if constexpr(bytes == 2) {
+        const auto v = int16_t(sample);
+        std::memcpy(out, &v, 2);
+    } else if constexpr(bytes == 3) {
+        out[0] = std::byte(sample);
+        out[1] = std::byte(sample >> 8);
+        out[2] = std::byte(sample >> 16);
+    } else {
+        std::memcpy(out, &sample, 4);
+    }
+}
+
+// interleaves planar samples from libflac
+// channels == 0 means any number of channels, given by num_channels
+template <int bytes, int channels>
+inline auto interleave(std::byte* out, const FLAC__int32* const buffer[], const uint32_t samples, const uint32_t num_channels) -> void {
+    auto i = uint32_t(0);
+#if defined(__SSE2__)
+    // only 16 bps reaches here, whose samples fit in int16, so saturating pack is exact
+    if constexpr(bytes == 2 && channels == 1) {
+        for(; i + 8 <= samples; i += 8) {
+            const auto a = _mm_loadu_si128(std::bit_cast<const __m128i*>(buffer[0] + i));
+            const auto b = _mm_loadu_si128(std::bit_cast<const __m128i*>(buffer[0] + i + 4));
+            _mm_storeu_si128(std::bit_cast<__m128i*>(out), _mm_packs_epi32(a, b));
+            out += 16;
+        }
+    } else if constexpr(bytes == 2 && channels == 2) {
+        for(; i + 4 <= samples; i += 4) {
+            const auto l = _mm_loadu_si128(std::bit_cast<const __m128i*>(buffer[0] + i));
+            const auto r = _mm_loadu_si128(std::bit_cast<const __m128i*>(buffer[1] + i));
+            _mm_storeu_si128(std::bit_cast<__m128i*>(out), _mm_packs_epi32(_mm_unpacklo_epi32(l, r), _mm_unpackhi_epi32(l, r)));
+            out += 16;
+        }
+    }
+#endif
+    if constexpr(channels != 0) {
+        for(; i < samples; i += 1) {
+            for(auto c = 0; c < channels; c += 1) {
+                pack_sample<bytes>(out, buffer[c][i]);
+                out += bytes;
+            }
+        }
+    } else {
+        for(; i < samples; i += 1) {
+            for(auto c = uint32_t(0); c < num_channels; c += 1) {
+                pack_sample<bytes>(out, buffer[c][i]);
+                out += bytes;
+            }
+        }
+    }
+}
+
+template <int bytes>
+inline auto interleave(std::byte* const out, const FLAC__int32* const buffer[], const uint32_t samples, const uint32_t channels) -> void {
+    switch(channels) {
+    case 1:
+        interleave<bytes, 1>(out, buffer, samples, channels);
+        break;
+    case 2:
+        interleave<bytes, 2>(out, buffer, samples, channels);
+        break;
+    default:
+        interleave<bytes, 0>(out, buffer, samples, channels);
+        break;
+    }
+}
+
+// out must have samples * channels * (bps / 8) bytes
+inline auto pack_pcm(std::byte* const out, const FLAC__int32* const buffer[], const uint32_t samples, const uint32_t channels, const uint32_t bps) -> bool {
+    switch(bps / 8) {
+    case 1:
+        interleave<1>(out, buffer, samples, channels);
+        return true;
+    case 2:
+        // the simd path saturates, while deeper samples are truncated like the other depths
+        if(bps == 16) {
+            interleave<2>(out, buffer, samples, channels);
+        } else {
+            interleave<2, 0>(out, buffer, samples, channels);
+        }
+        return true;
+    case 3:
+        interleave<3>(out, buffer, samples, channels);
+        return true;
+    case 4:
+        interleave<4>(out, buffer, samples, channels);
+        return true;
+    default:
+        return false;
+    }
+}
+} // namespace drivers::flac
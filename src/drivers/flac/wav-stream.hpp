@@ -0,0 +1,139 @@
+#pragma once
+#include <cstring>
+#include <mutex>
+
+#include "../../driver.hpp"
+#include "flac-to-wav.hpp"
+
+namespace drivers::flac {
+// serves wav reads by decoding only the frames covering the requested range
+// pcm offset maps linearly to sample number, so random access is a seek_absolute()
+class WavStream : public PhantomStream {
+  private:
+    class WindowDecoder : public FLAC::Decoder::File {
+      public:
+        std::optional<PCMInfo> metadata;
+        std::vector<std::byte> window;           // decoded pcm, starting at window_begin
+        FLAC__uint64           window_begin = 0; // in samples
+        FLAC__uint64           position     = 0; // next sample to be decoded
+
+        auto write_callback(const FLAC__Frame* const frame, const FLAC__int32* const buffer[]) -> FLAC__StreamDecoderWriteStatus override {
+            if(!metadata) {
+                return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
+            }
+
+            const auto p = window.size();
+            window.resize(p + frame->header.blocksize * metadata->get_block_align());
+            if(!pack_pcm(window.data() + p, buffer, frame->header.blocksize, metadata->channels, metadata->bps)) {
+                return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
+            }
+            position += frame->header.blocksize;
+
+            return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
+        }
+
+        auto metadata_callback(const FLAC__StreamMetadata* const metadata) -> void override {
+            if(metadata->type == FLAC__METADATA_TYPE_STREAMINFO) {
+                this->metadata = PCMInfo(metadata->data.stream_info);
+            }
+        }
+
+        auto error_callback(const FLAC__StreamDecoderErrorStatus /*status*/) -> void override {}
+    };
+
+    // reads at most this far ahead of the decoder are decoded through instead of seeking
+    constexpr static auto max_skip_seconds = 1;
+
+    std::mutex    mutex;
+    WindowDecoder decoder;
+    WavHeader     header;
+    size_t        block_align;
+
+    auto window_end() const -> size_t {
+        return decoder.window_begin * block_align + decoder.window.size();
+    }
+
+    // makes decoder.window contain sample, discarding everything before it
+    auto prepare_window(const FLAC__uint64 sample) -> bool {
+        const auto max_skip = FLAC__uint64(decoder.metadata->sample_rate) * max_skip_seconds;
+        if(sample < decoder.window_begin || sample > decoder.position + max_skip) {
+            decoder.window.clear();
+            decoder.window_begin = sample;
+            decoder.position     = sample;
+            if(!decoder.seek_absolute(sample)) {
+                decoder.flush();
+                return false;
+            }
+            return true;
+        }
+
+        const auto drop = std::min(sample, decoder.position) - decoder.window_begin;
+        decoder.window.erase(decoder.window.begin(), decoder.window.begin() + drop * block_align);
+        decoder.window_begin += drop;
+        while(decoder.position <= sample) {
+            const auto position = decoder.position;
+            if(!decoder.process_single() || decoder.position == position) {
+                return false;
+            }
+            if(decoder.position <= sample) {
+                // decoded through a frame before the requested one
+                decoder.window.clear();
+                decoder.window_begin = decoder.position;
+            }
+        }
+        return true;
+    }
+
+  public:
+    auto init(const char* const path) -> bool {
+        if(decoder.init(path) != FLAC__STREAM_DECODER_INIT_STATUS_OK || !decoder.process_until_end_of_metadata()) {
+            return false;
+        }
+        if(!decoder.metadata || decoder.metadata->total_samples == 0 || decoder.metadata->get_block_align() == 0) {
+            return false;
+        }
+        header      = make_wav_header(*decoder.metadata);
+        block_align = decoder.metadata->get_block_align();
+        return true;
+    }
+
+    auto get_size() const -> size_t override {
+        return sizeof(WavHeader) + decoder.metadata->get_pcm_size();
+    }
+
+    auto read(std::byte* const buffer, size_t size, const size_t offset) -> ssize_t override {
+        const auto lock = std::lock_guard(mutex);
+
+        const auto file_size = get_size();
+        if(offset >= file_size) {
+            return 0;
+        }
+        size = std::min(size, file_size - offset);
+
+        auto copied = size_t(0);
+        if(offset < sizeof(WavHeader)) {
+            copied = std::min(size, sizeof(WavHeader) - offset);
+            std::memcpy(buffer, std::bit_cast<const std::byte*>(&header) + offset, copied);
+        }
+
+        while(copied < size) {
+            const auto pcm_offset = offset + copied - sizeof(WavHeader);
+            if(pcm_offset < decoder.window_begin * block_align || pcm_offset >= window_end()) {
+                if(!prepare_window(pcm_offset / block_align)) {
+                    if(copied != 0) {
+                        break;
+                    }
+                    errno = EIO;
+                    return -1;
+                }
+                continue;
+            }
+            const auto window_offset = pcm_offset - decoder.window_begin * block_align;
+            const auto len           = std::min(size - copied, decoder.window.size() - window_offset);
+            std::memcpy(buffer + copied, decoder.window.data() + window_offset, len);
+            copied += len;
+        }
+        return copied;
+    }
+};
+} // namespace drivers::flac
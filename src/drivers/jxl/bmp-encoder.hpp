@@ -1,6 +1,11 @@
 #pragma once
+#include <cstring>
+
+#include <unistd.h>
+
 #include "../../memfd.hpp"
 #include "image.hpp"
+#include "swizzle.hpp"
 
 namespace drivers::jxl {
 struct BitmapFileHeader {
@@ -27,26 +32,31 @@ struct BitmapInfoHeader {
 
 constexpr auto BI_RGB = 0;
 
-inline auto encode_bmp(const char* const filename, const Image<4>& image) -> int {
-    auto file = open_memory_fd(filename);
-    if(!file) {
-        return -1;
-    }
+// pixels follow the headers immediately
+struct BitmapHeaders {
+    BitmapFileHeader file;
+    BitmapInfoHeader info;
+} __attribute__((packed));
 
-    const auto row_size = image.width * 4;
-    const auto bytes    = row_size * image.height;
+constexpr auto bmp_file_size(const size_t width, const size_t height) -> size_t {
+    return sizeof(BitmapHeaders) + width * height * 4;
+}
+
+// 32-bit bgra, bottom-up
+inline auto make_bmp_headers(const size_t width, const size_t height) -> BitmapHeaders {
+    auto headers = BitmapHeaders();
 
-    auto file_header        = BitmapFileHeader();
+    auto& file_header       = headers.file;
     file_header.bfType      = ('M' << 8) | 'B';
-    file_header.bfSize      = sizeof(BitmapFileHeader) + sizeof(BitmapInfoHeader) + bytes;
+    file_header.bfSize      = bmp_file_size(width, height);
     file_header.bfReserved1 = 0;
     file_header.bfReserved2 = 0;
-    file_header.bfOffBits   = sizeof(BitmapFileHeader) + sizeof(BitmapInfoHeader);
+    file_header.bfOffBits   = sizeof(BitmapHeaders);
 
-    auto info_header            = BitmapInfoHeader();
+    auto& info_header           = headers.info;
     info_header.biSize          = sizeof(BitmapInfoHeader);
-    info_header.biWidth         = image.width;
-    info_header.biHeight        = image.height;
+    info_header.biWidth         = width;
+    info_header.biHeight        = height;
     info_header.biPlanes        = 1;
     info_header.biBitCount      = 32;
     info_header.biCompression   = BI_RGB;
@@ -56,27 +66,34 @@ inline auto encode_bmp(const char* const filename, const Image<4>& image) -> int
     info_header.biClrUsed       = 0;
     info_header.biClrImportant  = 0;
 
-    if(!file.write(file_header) || !file.write(info_header)) {
+    return headers;
+}
+
+inline auto encode_bmp(const char* const filename, const Image<4>& image) -> int {
+    auto file = open_memory_fd(filename);
+    if(!file) {
         return -1;
     }
 
-    auto buf = std::vector<std::byte>();
-    buf.reserve(image.height * image.width * 4);
-    for(auto rr = size_t(0); rr < image.height; rr += 1) {
-        const auto r   = image.height - rr - 1;
-        const auto row = image.buffer.data() + r * row_size;
-        for(auto c = size_t(0); c < image.width; c += 1) {
-            const auto p = row + c * 4;
-            buf.emplace_back(p[2]);
-            buf.emplace_back(p[1]);
-            buf.emplace_back(p[0]);
-            buf.emplace_back(p[3]);
-        }
+    const auto size = bmp_file_size(image.width, image.height);
+    if(ftruncate(file.as_handle(), size) == -1) {
+        return -1;
     }
-    if(!file.write(buf.data(), buf.size())) {
+    const auto mapping = Mapping(file.as_handle(), size);
+    if(!mapping) {
         return -1;
     }
 
+    const auto headers = make_bmp_headers(image.width, image.height);
+    std::memcpy(mapping.get(), &headers, sizeof(headers));
+
+    const auto row_size = image.width * 4;
+    const auto pixels   = mapping.get() + sizeof(headers);
+    for(auto rr = size_t(0); rr < image.height; rr += 1) {
+        const auto r = image.height - rr - 1;
+        rgba_to_bgra(pixels + rr * row_size, image.buffer.data() + r * row_size, image.width);
+    }
+
     return file.release();
 }
 } // namespace drivers::jxl
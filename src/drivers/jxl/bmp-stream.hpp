@@ -0,0 +1,161 @@
+#pragma once
+#include <atomic>
+#include <cstring>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+#include <jxl/decode_cxx.h>
+#include <unistd.h>
+
+#include "../../driver.hpp"
+#include "../../memfd.hpp"
+#include "bmp-encoder.hpp"
+#include "jxl-decoder.hpp"
+#include "jxl-input.hpp"
+#include "parallel-runner.hpp"
+#include "swizzle.hpp"
+
+namespace drivers::jxl {
+// serves bmp reads while decoding only as far as they need
+// headers are known from basic info, so sniffing them costs no decode at all
+// the source is fed in chunks and a read returns as soon as the rows it covers are complete
+// note that bmp rows are stored bottom-up, so early parts of the pixel data are decoded last
+class BmpStream : public PhantomStream {
+  private:
+    std::mutex                        mutex;
+    JxlInput                          input;
+    JxlDecoderPtr                     decoder;
+    size_t                            width;
+    size_t                            height;
+    FileDescriptor                    file; // sparse until pixels are written
+    std::optional<Mapping>            mapping;
+    std::vector<std::atomic_uint32_t> row_pixels; // pixels written to each image row
+    bool                              finished = false;
+
+    // may be called from multiple threads, for disjoint ranges
+    static auto callback(void* const opaque, const size_t x, const size_t y, const size_t num_pixels, const void* const pixels) -> void {
+        auto&      self = *static_cast<BmpStream*>(opaque);
+        const auto dst  = self.mapping->get() + sizeof(BitmapHeaders) + ((self.height - y - 1) * self.width + x) * 4;
+        rgba_to_bgra(dst, static_cast<const std::byte*>(pixels), num_pixels);
+        self.row_pixels[y].fetch_add(num_pixels);
+    }
+
+    // runs the decoder until it needs more input or finishes
+    auto step() -> bool {
+        const static auto format = JxlPixelFormat{.num_channels = 4, .data_type = JxlDataType::JXL_TYPE_UINT8, .endianness = JxlEndianness::JXL_NATIVE_ENDIAN, .align = 1};
+
+        while(true) {
+            switch(JxlDecoderProcessInput(decoder.get())) {
+            case JXL_DEC_NEED_MORE_INPUT:
+                return input.feed(decoder.get());
+            case JXL_DEC_NEED_IMAGE_OUT_BUFFER:
+                if(JxlDecoderSetImageOutCallback(decoder.get(), &format, callback, this) != JXL_DEC_SUCCESS) {
+                    return false;
+                }
+                break;
+            case JXL_DEC_FULL_IMAGE:
+                break;
+            case JXL_DEC_SUCCESS:
+                finished = true;
+                decoder.reset();
+                return true;
+            default:
+                return false;
+            }
+        }
+    }
+
+    // image rows, not bmp rows
+    auto ensure_rows(const size_t first, const size_t last) -> bool {
+        for(auto y = first; y <= last; y += 1) {
+            while(row_pixels[y].load() < width) {
+                if(finished || !step()) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+  public:
+    auto init(const char* const path) -> bool {
+        const auto info_result = read_basic_info(path);
+        if(!info_result) {
+            return false;
+        }
+        const auto& info = info_result.as_value();
+        // later frames would overwrite rows which may have been read already
+        if(info.have_animation || info.xsize == 0 || info.ysize == 0) {
+            return false;
+        }
+        width  = info.xsize;
+        height = info.ysize;
+
+        file = open_memory_fd("encoded");
+        if(!file || ftruncate(file.as_handle(), get_size()) == -1) {
+            return false;
+        }
+        mapping.emplace(file.as_handle(), get_size());
+        if(!*mapping) {
+            return false;
+        }
+        const auto headers = make_bmp_headers(width, height);
+        std::memcpy(mapping->get(), &headers, sizeof(headers));
+        row_pixels = std::vector<std::atomic_uint32_t>(height);
+
+        decoder = JxlDecoderMake(NULL);
+        if(!input.open(path, false) || !parallel_runner.attach(decoder.get())) {
+            return false;
+        }
+        if(JxlDecoderSubscribeEvents(decoder.get(), JXL_DEC_FULL_IMAGE) != JXL_DEC_SUCCESS) {
+            return false;
+        }
+        return input.feed(decoder.get());
+    }
+
+    auto get_size() const -> size_t override {
+        return bmp_file_size(width, height);
+    }
+
+    auto read(std::byte* const buffer, size_t size, const size_t offset) -> ssize_t override {
+        const auto lock = std::lock_guard(mutex);
+
+        const auto file_size = get_size();
+        if(offset >= file_size) {
+            return 0;
+        }
+        size = std::min(size, file_size - offset);
+
+        if(offset + size > sizeof(BitmapHeaders)) {
+            const auto row_size  = width * 4;
+            const auto pixels    = std::max(offset, sizeof(BitmapHeaders)) - sizeof(BitmapHeaders);
+            const auto first_row = pixels / row_size;
+            const auto last_row  = (offset + size - sizeof(BitmapHeaders) - 1) / row_size;
+            if(!ensure_rows(height - last_row - 1, height - first_row - 1)) {
+                errno = EIO;
+                return -1;
+            }
+        }
+        std::memcpy(buffer, mapping->get() + offset, size);
+        return size;
+    }
+
+    auto is_shareable() const -> bool override {
+        return true;
+    }
+
+    // the mapping stays valid without the fd
+    auto take_file() -> FileDescriptor override {
+        const auto lock = std::lock_guard(mutex);
+        if(!finished) {
+            for(const auto& pixels : row_pixels) {
+                if(pixels.load() < width) {
+                    return FileDescriptor();
+                }
+            }
+        }
+        return std::move(file);
+    }
+};
+} // namespace drivers::jxl
@@ -1,4 +1,5 @@
 #pragma once
+#include <array>
 #include <filesystem>
 #include <optional>
 #include <string>
@@ -6,20 +7,71 @@
 
 #include "../../driver.hpp"
 #include "bmp-encoder.hpp"
+#include "bmp-stream.hpp"
+#include "image-cache.hpp"
 #include "jpg-encoder.hpp"
 #include "jxl-decoder.hpp"
+#include "jxl-to-bmp.hpp"
 #include "png-encoder.hpp"
 
 namespace drivers::jxl {
 class Driver {
   private:
+    mutable ImageCache image_cache;
+    PngOptions         png_options;
+    JpegOptions        jpeg_options;
+
+    auto find_rgba(const std::filesystem::path& real_path) const -> std::pair<ImageCache::ImagePtr, std::optional<SourceIdentity>> {
+        struct stat st;
+        if(::stat(real_path.c_str(), &st) == -1) {
+            return {nullptr, std::nullopt};
+        }
+        const auto source = SourceIdentity(st);
+        return {image_cache.find(real_path.string(), source), source};
+    }
+
+    // shared by every format but reconstructed jpeg
+    auto decode_rgba(const std::filesystem::path& real_path) const -> ImageCache::ImagePtr {
+        const auto [cached, source] = find_rgba(real_path);
+        if(cached || !source) {
+            return cached;
+        }
+
+        auto decoded = decode_jxl<4>(real_path.c_str());
+        if(!decoded) {
+            return nullptr;
+        }
+        auto image = std::make_shared<const Image<4>>(std::move(decoded.as_value()));
+        image_cache.insert(real_path.string(), image, *source);
+        return image;
+    }
+
   public:
-    auto get_real_path(const std::string_view path_str) const -> std::optional<std::string> {
-        if(!path_str.ends_with(".jpg") && !path_str.ends_with(".png") && !path_str.ends_with(".bmp")) {
-            return std::nullopt;
+    constexpr static auto source_extension   = std::string_view(".jxl");
+    constexpr static auto phantom_extensions = std::array<std::string_view, 3>{".bmp", ".png", ".jpg"};
+
+    // only settings of the format of path, so that changing them keeps the other formats cached
+    auto get_version(const std::string_view path) const -> std::string {
+        const auto extension = std::filesystem::path(path).extension();
+        if(extension == ".png") {
+            return std::string("jxl-1-png-") + get_png_profile_name(png_options.profile) + (png_options.parallel ? "-parallel" : "");
+        }
+        if(extension == ".jpg") {
+            return "jxl-1-jpg-" + get_jpeg_options_name(jpeg_options);
         }
+        return "jxl-1";
+    }
 
-        auto real_path = std::filesystem::path(path_str).replace_extension(".jxl");
+    auto set_png_options(const PngOptions& options) -> void {
+        png_options = options;
+    }
+
+    auto set_jpeg_options(const JpegOptions& options) -> void {
+        jpeg_options = options;
+    }
+
+    auto get_real_path(const std::string_view path_str) const -> std::optional<std::string> {
+        auto real_path = std::filesystem::path(path_str).replace_extension(source_extension);
         if(!std::filesystem::exists(real_path)) {
             return std::nullopt;
         }
@@ -27,13 +79,9 @@ class Driver {
     }
 
     auto get_phantom_paths(const std::string_view path_str) const -> std::optional<std::vector<std::string>> {
-        if(!path_str.ends_with(".jxl")) {
-            return std::nullopt;
-        }
-
         auto       files = std::vector<std::string>();
         const auto path  = std::filesystem::path(path_str);
-        for(const auto ext : {".bmp", ".png", ".jpg"}) {
+        for(const auto ext : phantom_extensions) {
             auto file = std::filesystem::path(path).replace_extension(ext);
             files.emplace_back(file.string());
         }
@@ -64,27 +112,63 @@ class Driver {
                 return reconstructed.as_value().release();
             }
 
-            const auto bytes = decode_jxl<3>(real_path.c_str());
-            if(!bytes) {
+            const auto image = decode_rgba(real_path);
+            if(!image) {
                 return -1;
             }
-            return encode_jpg("encoded", bytes.as_value());
+            return encode_jpg("encoded", to_rgb(*image), jpeg_options);
         } else if(require_png) {
-            const auto bytes = decode_jxl<4>(real_path.c_str());
-            if(!bytes) {
+            const auto image = decode_rgba(real_path);
+            if(!image) {
                 return -1;
             }
-            return encode_png("encoded", bytes.as_value());
+            return encode_png("encoded", *image, png_options);
         } else if(require_bmp) {
-            const auto bytes = decode_jxl<4>(real_path.c_str());
-            if(!bytes) {
+            // reuse a sibling's decode if there is one, otherwise skip the intermediate image
+            if(const auto image = find_rgba(real_path).first) {
+                return encode_bmp("encoded", *image);
+            }
+            auto bmp = decode_jxl_to_bmp(real_path.c_str());
+            if(!bmp) {
                 return -1;
             }
-            return encode_bmp("encoded", bytes.as_value());
+            return bmp.as_value().release();
         }
 
         return -1;
     }
+
+    // only bmp has a fixed layout which maps offsets to pixels
+    auto open_phantom_stream(const std::string_view path_str) const -> std::unique_ptr<PhantomStream> {
+        if(!path_str.ends_with(".bmp")) {
+            return nullptr;
+        }
+
+        const auto real_path = std::filesystem::path(path_str).replace_extension(".jxl");
+        auto       stream    = std::unique_ptr<BmpStream>(new BmpStream());
+        if(!stream->init(real_path.c_str())) {
+            return nullptr;
+        }
+        return stream;
+    }
+
+    auto get_phantom_file_size(const std::string_view path_str) const -> std::optional<size_t> {
+        // png and jpg sizes are not known until they are encoded
+        if(!path_str.ends_with(".bmp")) {
+            return std::nullopt;
+        }
+
+        const auto real_path = std::filesystem::path(path_str).replace_extension(".jxl");
+        const auto info      = read_basic_info(real_path.c_str());
+        if(!info) {
+            return std::nullopt;
+        }
+
+        // decoded image is rotated by orientation
+        const auto& i         = info.as_value();
+        const auto  transpose = i.orientation > JXL_ORIENT_FLIP_VERTICAL;
+        return bmp_file_size(transpose ? i.ysize : i.xsize, transpose ? i.xsize : i.ysize);
+    }
 };
 
 static_assert(::Driver<Driver>);
@@ -0,0 +1,71 @@
+#pragma once
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "../../cache.hpp"
+#include "../../util/thread.hpp"
+#include "image.hpp"
+
+namespace drivers::jxl {
+// recently decoded images, so that sibling formats of one source share a single decode
+// entries are expected to be short-lived, so the budget is small and eviction is plain lru
+class ImageCache {
+  public:
+    using ImagePtr = std::shared_ptr<const Image<4>>;
+
+  private:
+    struct Entry {
+        std::string    path;
+        SourceIdentity source;
+        ImagePtr       image;
+    };
+
+    struct Entries {
+        std::vector<Entry> entries; // most recently used last
+        size_t             total_size = 0;
+    };
+
+    Critical<Entries> critical_entries;
+    size_t            budget;
+
+  public:
+    auto find(const std::string_view path, const SourceIdentity& source) -> ImagePtr {
+        auto [lock, e] = critical_entries.access();
+        const auto p   = std::find_if(e.entries.begin(), e.entries.end(), [path](const Entry& entry) { return entry.path == path; });
+        if(p == e.entries.end()) {
+            return nullptr;
+        }
+        if(!(p->source == source)) {
+            e.total_size -= p->image->buffer.size();
+            e.entries.erase(p);
+            return nullptr;
+        }
+        std::rotate(p, std::next(p), e.entries.end());
+        return e.entries.back().image;
+    }
+
+    auto insert(const std::string_view path, ImagePtr image, const SourceIdentity& source) -> void {
+        const auto size = image->buffer.size();
+        if(size > budget) {
+            return;
+        }
+
+        auto [lock, e] = critical_entries.access();
+        if(const auto p = std::find_if(e.entries.begin(), e.entries.end(), [path](const Entry& entry) { return entry.path == path; }); p != e.entries.end()) {
+            e.total_size -= p->image->buffer.size();
+            e.entries.erase(p);
+        }
+        while(e.total_size + size > budget) {
+            e.total_size -= e.entries.front().image->buffer.size();
+            e.entries.erase(e.entries.begin());
+        }
+        e.entries.push_back(Entry{std::string(path), source, std::move(image)});
+        e.total_size += size;
+    }
+
+    ImageCache(const size_t budget = size_t(256) << 20) : budget(budget) {}
+};
+} // namespace drivers::jxl
@@ -8,4 +8,21 @@ struct Image {
     size_t                 height;
     std::vector<std::byte> buffer;
 };
+
+// drops alpha, same as decoding to 3 channels
+inline auto to_rgb(const Image<4>& image) -> Image<3> {
+    const auto pixels = image.width * image.height;
+
+    auto rgb = Image<3>{image.width, image.height, std::vector<std::byte>(pixels * 3)};
+    auto src = image.buffer.data();
+    auto dst = rgb.buffer.data();
+    for(auto i = size_t(0); i < pixels; i += 1) {
+        dst[0] = src[0];
+        dst[1] = src[1];
+        dst[2] = src[2];
+        src += 4;
+        dst += 3;
+    }
+    return rgb;
+}
 } // namespace drivers::jxl
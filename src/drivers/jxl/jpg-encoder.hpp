@@ -1,13 +1,52 @@
 #pragma once
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
 #include <stdio.h>
+#include <unistd.h>
 
 #include <jpeglib.h>
+#include <jerror.h>
 #include <setjmp.h>
 
 #include "../../memfd.hpp"
 #include "image.hpp"
 
 namespace drivers::jxl {
+enum class JpegSubsampling {
+    S444,
+    S422,
+    S420, // libjpeg default
+};
+
+struct JpegOptions {
+    int             quality     = 75;
+    JpegSubsampling subsampling = JpegSubsampling::S420;
+    bool            fast_dct    = false; // JDCT_IFAST, less accurate
+    bool            optimize    = false; // optimal huffman tables, needs another pass
+    bool            progressive = false;
+};
+
+inline auto parse_jpeg_subsampling(const std::string_view str) -> std::optional<JpegSubsampling> {
+    if(str == "444") {
+        return JpegSubsampling::S444;
+    } else if(str == "422") {
+        return JpegSubsampling::S422;
+    } else if(str == "420") {
+        return JpegSubsampling::S420;
+    }
+    return std::nullopt;
+}
+
+// changes whenever the output changes
+inline auto get_jpeg_options_name(const JpegOptions& options) -> std::string {
+    const auto subsampling = options.subsampling == JpegSubsampling::S444 ? "444" : options.subsampling == JpegSubsampling::S422 ? "422" : "420";
+    return "q" + std::to_string(options.quality) + "-" + subsampling +
+           (options.fast_dct ? "-fastdct" : "") + (options.optimize ? "-optimize" : "") + (options.progressive ? "-progressive" : "");
+}
+
 class Jpeg {
   private:
     jpeg_compress_struct jpeg;
@@ -21,7 +60,9 @@ class Jpeg {
         return &jpeg;
     }
 
-    Jpeg() {
+    // err is used from the start
+    Jpeg(jpeg_error_mgr& err) {
+        jpeg.err = &err;
         jpeg_create_compress(&jpeg);
     }
 
@@ -39,37 +80,117 @@ struct ErrorManager {
         longjmp(self.jmpbuf, 1);
     }
 
+    // jpeg_std_error() resets every handler, so it must come first
     ErrorManager() {
+        jpeg_std_error(&jerr);
         jerr.error_exit = error_exit;
     }
 };
 
-inline auto encode_jpg(const char* const filename, const Image<3>& image, const int quality = 75) -> int {
-    auto file = open_memory_file<OpenMode::Write>(filename);
-    if(file == NULL) {
-        return -1;
+// writes compressed data to fd in large blocks, instead of through stdio
+// found through client_data of the compressor
+struct DestinationManager {
+    jpeg_destination_mgr dest;
+    int                  fd;
+    std::vector<JOCTET>  buffer = std::vector<JOCTET>(size_t(1) << 18);
+
+    static auto write_all(const int fd, const JOCTET* data, size_t size) -> bool {
+        while(size > 0) {
+            const auto written = ::write(fd, data, size);
+            if(written <= 0) {
+                return false;
+            }
+            data += written;
+            size -= written;
+        }
+        return true;
+    }
+
+    static void init_destination(const j_compress_ptr cinfo) {
+        auto& self                 = *static_cast<DestinationManager*>(cinfo->client_data);
+        self.dest.next_output_byte = self.buffer.data();
+        self.dest.free_in_buffer   = self.buffer.size();
+    }
+
+    // called when the buffer is full, regardless of free_in_buffer
+    static auto empty_output_buffer(const j_compress_ptr cinfo) -> boolean {
+        auto& self = *static_cast<DestinationManager*>(cinfo->client_data);
+        if(!write_all(self.fd, self.buffer.data(), self.buffer.size())) {
+            ERREXIT(cinfo, JERR_FILE_WRITE);
+        }
+        init_destination(cinfo);
+        return TRUE;
     }
 
-    auto jpeg = Jpeg();
+    static void term_destination(const j_compress_ptr cinfo) {
+        auto& self = *static_cast<DestinationManager*>(cinfo->client_data);
+        if(!write_all(self.fd, self.buffer.data(), self.buffer.size() - self.dest.free_in_buffer)) {
+            ERREXIT(cinfo, JERR_FILE_WRITE);
+        }
+    }
+
+    DestinationManager(const int fd) : fd(fd) {
+        dest.init_destination    = init_destination;
+        dest.empty_output_buffer = empty_output_buffer;
+        dest.term_destination    = term_destination;
+    }
+};
+
+// separated from encode_jpg, so that longjmp cannot clobber its locals
+inline auto write_jpg(const int fd, const Image<3>& image, const JpegOptions& options) -> bool {
     auto em   = ErrorManager();
-    jpeg->err = jpeg_std_error(&em.jerr);
+    auto jpeg = Jpeg(em.jerr);
+    auto dm   = DestinationManager(fd);
+    auto rows = std::vector<JSAMPROW>(image.height);
     if(setjmp(em.jmpbuf)) {
-        return -1;
+        return false;
     }
 
-    jpeg_stdio_dest(jpeg, file.get());
+    jpeg->client_data      = &dm;
+    jpeg->dest             = &dm.dest;
     jpeg->image_width      = image.width;
     jpeg->image_height     = image.height;
     jpeg->input_components = 3;
     jpeg->in_color_space   = JCS_RGB;
     jpeg_set_defaults(jpeg);
-    jpeg_set_quality(jpeg, quality, TRUE);
-    jpeg_start_compress(jpeg, TRUE);
+    jpeg_set_quality(jpeg, options.quality, TRUE);
+    switch(options.subsampling) {
+    case JpegSubsampling::S444:
+        jpeg->comp_info[0].h_samp_factor = 1;
+        jpeg->comp_info[0].v_samp_factor = 1;
+        break;
+    case JpegSubsampling::S422:
+        jpeg->comp_info[0].h_samp_factor = 2;
+        jpeg->comp_info[0].v_samp_factor = 1;
+        break;
+    case JpegSubsampling::S420:
+        break;
+    }
+    if(options.fast_dct) {
+        jpeg->dct_method = JDCT_IFAST;
+    }
+    jpeg->optimize_coding = options.optimize ? TRUE : FALSE;
+    if(options.progressive) {
+        jpeg_simple_progression(jpeg);
+    }
+
+    // libjpeg takes as many rows as it can at once
     for(auto i = size_t(0); i < image.height; i += 1) {
-        const auto rows = image.buffer.data() + image.width * i * 3;
-        jpeg_write_scanlines(jpeg, std::bit_cast<JSAMPROW*>(&rows), 1);
+        rows[i] = std::bit_cast<JSAMPROW>(image.buffer.data() + image.width * i * 3);
+    }
+    jpeg_start_compress(jpeg, TRUE);
+    while(jpeg->next_scanline < jpeg->image_height) {
+        jpeg_write_scanlines(jpeg, rows.data() + jpeg->next_scanline, jpeg->image_height - jpeg->next_scanline);
     }
     jpeg_finish_compress(jpeg);
-    return extract_fd_from_file(file);
+    return true;
+}
+
+inline auto encode_jpg(const char* const filename, const Image<3>& image, const JpegOptions& options = {}) -> int {
+    auto file = open_memory_fd(filename);
+    if(!file || !write_jpg(file.as_handle(), image, options)) {
+        return -1;
+    }
+    return file.release();
 }
 } // namespace drivers::jxl
@@ -1,27 +1,33 @@
 #pragma once
 #include <filesystem>
 #include <fstream>
+#include <optional>
 #include <string_view>
 
 #include <jxl/decode_cxx.h>
 #include <jxl/encode_cxx.h>
+#include <unistd.h>
 
 #include "../../memfd.hpp"
 #include "../../util/misc.hpp"
 #include "image.hpp"
+#include "jxl-input.hpp"
+#include "parallel-runner.hpp"
 
 namespace drivers::jxl {
 template <int channels>
 auto decode_jxl(const char* const path) -> Result<Image<channels>> {
-    const auto file_result = read_binary(path);
-    if(!file_result) {
-        return file_result.as_error();
+    auto input = JxlInput();
+    if(!input.open(path, true)) {
+        return Error("failed to open file");
     }
-    const auto& file = file_result.as_value();
 
     const auto decoder = JxlDecoderMake(NULL);
 
-    if(JxlDecoderSetInput(decoder.get(), std::bit_cast<uint8_t*>(file.data()), file.size()) != JXL_DEC_SUCCESS) {
+    if(!parallel_runner.attach(decoder.get())) {
+        return Error("jxl: failed to set parallel runner");
+    }
+    if(!input.feed(decoder.get())) {
         return Error("jxl: failed to set input");
     }
 
@@ -38,7 +44,10 @@ auto decode_jxl(const char* const path) -> Result<Image<channels>> {
         case JXL_DEC_ERROR:
             return Error("jxl: decoder error");
         case JXL_DEC_NEED_MORE_INPUT:
-            return Error("jxl: no more inputs");
+            if(!input.feed(decoder.get())) {
+                return Error("jxl: no more inputs");
+            }
+            break;
         case JXL_DEC_BASIC_INFO:
             if(JxlDecoderGetBasicInfo(decoder.get(), &info) != JXL_DEC_SUCCESS) {
                 return Error("jxl: failed to get basic info");
@@ -71,33 +80,84 @@ finish:
     return Image<channels>{info.xsize, info.ysize, std::move(buffer)};
 }
 
+// reads only as much of the file as needed to parse the header
+inline auto read_basic_info(const char* const path) -> Result<JxlBasicInfo> {
+    auto input = JxlInput();
+    if(!input.open(path, false)) {
+        return Error("failed to open file");
+    }
+
+    const auto decoder = JxlDecoderMake(NULL);
+
+    if(JxlDecoderSubscribeEvents(decoder.get(), JXL_DEC_BASIC_INFO) != JXL_DEC_SUCCESS) {
+        return Error("jxl: failed to subscribe events");
+    }
+    if(!input.feed(decoder.get())) {
+        return Error("jxl: failed to set input");
+    }
+
+    while(true) {
+        switch(JxlDecoderProcessInput(decoder.get())) {
+        case JXL_DEC_ERROR:
+            return Error("jxl: decoder error");
+        case JXL_DEC_NEED_MORE_INPUT:
+            if(!input.feed(decoder.get())) {
+                return Error("jxl: no more inputs");
+            }
+            break;
+        case JXL_DEC_BASIC_INFO: {
+            auto info = JxlBasicInfo();
+            if(JxlDecoderGetBasicInfo(decoder.get(), &info) != JXL_DEC_SUCCESS) {
+                return Error("jxl: failed to get basic info");
+            }
+            return info;
+        }
+        default:
+            return Error("jxl: unknown state");
+        }
+    }
+}
+
+// reconstructs the original jpeg of a losslessly recompressed file
+// the decoder writes straight into a mapped memfd, which is grown only if the estimate was too small
 inline auto decode_jxl_to_jpeg(const char* const path) -> Result<FileDescriptor> {
-    const auto file_result = read_binary(path);
-    if(!file_result) {
-        return file_result.as_error();
+    auto input = JxlInput();
+    if(!input.open(path, true)) {
+        return Error("failed to open file");
     }
-    const auto& file = file_result.as_value();
 
-    const auto decoder         = JxlDecoderMake(NULL);
-    auto       jpeg_data_chunk = std::vector<std::byte>(16384);
-    auto       decoded         = open_memory_fd(std::filesystem::path(path).filename().c_str());
+    const auto decoder = JxlDecoderMake(NULL);
+    auto       decoded = open_memory_fd(std::filesystem::path(path).filename().c_str());
     if(!decoded) {
         return Error("failed to open temporary file");
     }
+    if(!parallel_runner.attach(decoder.get())) {
+        return Error("jxl: failed to set parallel runner");
+    }
 
-    const auto write_decoded = [&decoder, &jpeg_data_chunk, &decoded]() -> Result<size_t> {
-        const auto used_jpeg_output = jpeg_data_chunk.size() - JxlDecoderReleaseJPEGBuffer(decoder.get());
-        if(used_jpeg_output == 0) {
-            return size_t(used_jpeg_output);
-        }
+    // recompression saves about 20%, so the jpeg rarely exceeds 1.5 times of the source
+    const auto page_size = size_t(sysconf(_SC_PAGESIZE));
+    auto       capacity  = (input.get_size() + input.get_size() / 2 + page_size) / page_size * page_size;
+    auto       produced  = size_t(0);
+    auto       mapping   = std::optional<Mapping>();
 
-        if(!decoded.write(jpeg_data_chunk.data(), jpeg_data_chunk.size())) {
-            return Error("jxl: failed to write decoded buffer");
+    const auto set_buffer = [&]() -> bool {
+        if(ftruncate(decoded.as_handle(), capacity) == -1) {
+            return false;
+        }
+        mapping.reset();
+        mapping.emplace(decoded.as_handle(), capacity);
+        if(!*mapping) {
+            return false;
         }
-        return size_t(used_jpeg_output);
+        return JxlDecoderSetJPEGBuffer(decoder.get(), std::bit_cast<uint8_t*>(mapping->get() + produced), capacity - produced) == JXL_DEC_SUCCESS;
     };
 
-    if(JxlDecoderSetInput(decoder.get(), std::bit_cast<uint8_t*>(file.data()), file.size()) != JXL_DEC_SUCCESS) {
+    const auto release_buffer = [&]() -> void {
+        produced = capacity - JxlDecoderReleaseJPEGBuffer(decoder.get());
+    };
+
+    if(!input.feed(decoder.get())) {
         return Error("jxl: failed to set input");
     }
 
@@ -110,22 +170,25 @@ inline auto decode_jxl_to_jpeg(const char* const path) -> Result<FileDescriptor>
         case JXL_DEC_ERROR:
             return Error("jxl: decoder error");
         case JXL_DEC_NEED_MORE_INPUT:
-            return Error("jxl: no more inputs");
+            if(!input.feed(decoder.get())) {
+                return Error("jxl: no more inputs");
+            }
+            break;
         case JXL_DEC_JPEG_RECONSTRUCTION:
-            if(JxlDecoderSetJPEGBuffer(decoder.get(), std::bit_cast<uint8_t*>(jpeg_data_chunk.data()), jpeg_data_chunk.size()) != JXL_DEC_SUCCESS) {
+            if(!set_buffer()) {
                 return Error("jxl: failed to set JPEG buffer");
             }
             break;
-        case JXL_DEC_JPEG_NEED_MORE_OUTPUT: {
-            if(const auto used_size = write_decoded(); !used_size) {
-                return used_size.as_error();
-            } else if(used_size.as_value() == 0) {
-                jpeg_data_chunk.resize(jpeg_data_chunk.size() * 2);
-            }
-            if(JxlDecoderSetJPEGBuffer(decoder.get(), std::bit_cast<uint8_t*>(jpeg_data_chunk.data()), jpeg_data_chunk.size()) != JXL_DEC_SUCCESS) {
+        case JXL_DEC_JPEG_NEED_MORE_OUTPUT:
+            release_buffer();
+            capacity *= 2;
+            if(!set_buffer()) {
                 return Error("jxl: failed to set JPEG buffer");
             }
-        } break;
+            break;
+        case JXL_DEC_NEED_IMAGE_OUT_BUFFER:
+            // no reconstruction data, do not decode pixels for nothing
+            return Error("jxl: not a recompressed jpeg");
         case JXL_DEC_FULL_IMAGE:
             break;
         case JXL_DEC_SUCCESS:
@@ -136,8 +199,13 @@ inline auto decode_jxl_to_jpeg(const char* const path) -> Result<FileDescriptor>
         }
     }
 finish:
-    if(const auto used_size = write_decoded(); !used_size) {
-        return used_size.as_error();
+    if(!mapping) {
+        return Error("jxl: not a recompressed jpeg");
+    }
+    release_buffer();
+    mapping.reset();
+    if(ftruncate(decoded.as_handle(), produced) == -1) {
+        return Error("failed to truncate temporary file");
     }
     return decoded;
 }
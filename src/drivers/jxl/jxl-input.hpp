@@ -0,0 +1,112 @@
+#pragma once
+#include <cstring>
+#include <vector>
+
+#include <jxl/decode.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+
+#include "../../memfd.hpp"
+
+namespace drivers::jxl {
+// feeds a source file to a decoder without reading it into memory first
+// the file is mapped as a whole if possible, otherwise it is given in growing chunks on JXL_DEC_NEED_MORE_INPUT
+class JxlInput {
+  private:
+    File                   file;
+    std::byte*             map      = nullptr;
+    size_t                 map_size = 0;
+    bool                   map_fed  = false;
+    size_t                 size     = 0;
+    std::vector<std::byte> buffer;
+    size_t                 chunk_size = 4096;
+
+    // mappings of remote files may fault when the file changes on the server
+    static auto is_mappable(const int fd, const struct stat& st) -> bool {
+        constexpr auto nfs_magic  = 0x6969;
+        constexpr auto smb2_magic = 0xfe534d42;
+        constexpr auto cifs_magic = 0xff534d42;
+        constexpr auto fuse_magic = 0x65735546;
+
+        if(!S_ISREG(st.st_mode) || st.st_size == 0) {
+            return false;
+        }
+        struct statfs fs;
+        if(fstatfs(fd, &fs) == -1) {
+            return false;
+        }
+        const auto type = (unsigned long)fs.f_type;
+        return type != nfs_magic && type != smb2_magic && type != cifs_magic && type != fuse_magic;
+    }
+
+    auto feed_map(JxlDecoder* const decoder) -> bool {
+        if(map_fed) {
+            return false;
+        }
+        map_fed = true;
+        if(JxlDecoderSetInput(decoder, std::bit_cast<uint8_t*>(map), map_size) != JXL_DEC_SUCCESS) {
+            return false;
+        }
+        JxlDecoderCloseInput(decoder);
+        return true;
+    }
+
+    auto feed_chunk(JxlDecoder* const decoder) -> bool {
+        const auto remaining = JxlDecoderReleaseInput(decoder);
+        if(remaining != 0) {
+            std::memmove(buffer.data(), buffer.data() + buffer.size() - remaining, remaining);
+        }
+        buffer.resize(remaining + chunk_size);
+        const auto read = fread(buffer.data() + remaining, 1, chunk_size, file.get());
+        buffer.resize(remaining + read);
+        chunk_size = std::min(chunk_size * 2, size_t(1) << 20);
+        return read != 0 && JxlDecoderSetInput(decoder, std::bit_cast<uint8_t*>(buffer.data()), buffer.size()) == JXL_DEC_SUCCESS;
+    }
+
+  public:
+    // allow_map should be false if only the beginning of the file is needed
+    auto open(const char* const path, const bool allow_map) -> bool {
+        file = File(fopen(path, "rb"));
+        if(file == NULL) {
+            return false;
+        }
+
+        const auto fd = fileno(file.get());
+        struct stat st;
+        if(fstat(fd, &st) == -1) {
+            return true;
+        }
+        size = st.st_size;
+        if(!allow_map || !is_mappable(fd, st)) {
+            return true;
+        }
+        const auto ptr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(ptr == MAP_FAILED) {
+            return true;
+        }
+        madvise(ptr, st.st_size, MADV_SEQUENTIAL);
+        map      = std::bit_cast<std::byte*>(ptr);
+        map_size = st.st_size;
+        return true;
+    }
+
+    // size of the source file, 0 if unknown
+    auto get_size() const -> size_t {
+        return size;
+    }
+
+    // gives the decoder more input
+    // returns false at the end of the file
+    auto feed(JxlDecoder* const decoder) -> bool {
+        return map != nullptr ? feed_map(decoder) : feed_chunk(decoder);
+    }
+
+    // the decoder must release the input before this is destroyed
+    ~JxlInput() {
+        if(map != nullptr) {
+            munmap(map, map_size);
+        }
+    }
+};
+} // namespace drivers::jxl
@@ -0,0 +1,102 @@
+#pragma once
+#include <cstring>
+#include <optional>
+
+#include <jxl/decode_cxx.h>
+#include <unistd.h>
+
+#include "../../memfd.hpp"
+#include "bmp-encoder.hpp"
+#include "jxl-input.hpp"
+#include "parallel-runner.hpp"
+#include "swizzle.hpp"
+
+namespace drivers::jxl {
+// decodes into the pixel area of a mapped bmp file, without intermediate images
+// pixels are written to their flipped and swizzled position as the decoder produces them
+inline auto decode_jxl_to_bmp(const char* const path) -> Result<FileDescriptor> {
+    struct Output {
+        std::byte* pixels;
+        size_t     width;
+        size_t     height;
+
+        // may be called from multiple threads, for disjoint ranges
+        static auto callback(void* const opaque, const size_t x, const size_t y, const size_t num_pixels, const void* const pixels) -> void {
+            const auto& self = *static_cast<Output*>(opaque);
+
+            const auto dst = self.pixels + ((self.height - y - 1) * self.width + x) * 4;
+            rgba_to_bgra(dst, static_cast<const std::byte*>(pixels), num_pixels);
+        }
+    };
+
+    auto input = JxlInput();
+    if(!input.open(path, true)) {
+        return Error("failed to open file");
+    }
+
+    const auto decoder = JxlDecoderMake(NULL);
+    auto       file    = open_memory_fd("encoded");
+    auto       mapping = std::optional<Mapping>();
+    auto       output  = Output();
+
+    const static auto format = JxlPixelFormat{.num_channels = 4, .data_type = JxlDataType::JXL_TYPE_UINT8, .endianness = JxlEndianness::JXL_NATIVE_ENDIAN, .align = 1};
+
+    if(!file) {
+        return Error("failed to open temporary file");
+    }
+    if(!parallel_runner.attach(decoder.get())) {
+        return Error("jxl: failed to set parallel runner");
+    }
+    if(!input.feed(decoder.get())) {
+        return Error("jxl: failed to set input");
+    }
+    if(JxlDecoderSubscribeEvents(decoder.get(), JXL_DEC_BASIC_INFO | JXL_DEC_FULL_IMAGE) != JXL_DEC_SUCCESS) {
+        return Error("jxl: failed to subscribe events");
+    }
+
+    while(true) {
+        switch(JxlDecoderProcessInput(decoder.get())) {
+        case JXL_DEC_ERROR:
+            return Error("jxl: decoder error");
+        case JXL_DEC_NEED_MORE_INPUT:
+            if(!input.feed(decoder.get())) {
+                return Error("jxl: no more inputs");
+            }
+            break;
+        case JXL_DEC_BASIC_INFO: {
+            auto info = JxlBasicInfo();
+            if(JxlDecoderGetBasicInfo(decoder.get(), &info) != JXL_DEC_SUCCESS) {
+                return Error("jxl: failed to get basic info");
+            }
+
+            const auto size = bmp_file_size(info.xsize, info.ysize);
+            if(ftruncate(file.as_handle(), size) == -1) {
+                return Error("failed to resize temporary file");
+            }
+            mapping.emplace(file.as_handle(), size);
+            if(!*mapping) {
+                return Error("failed to map temporary file");
+            }
+
+            const auto headers = make_bmp_headers(info.xsize, info.ysize);
+            std::memcpy(mapping->get(), &headers, sizeof(headers));
+            output = Output{mapping->get() + sizeof(headers), info.xsize, info.ysize};
+        } break;
+        case JXL_DEC_NEED_IMAGE_OUT_BUFFER:
+            if(!mapping) {
+                return Error("jxl: no basic info");
+            }
+            if(JxlDecoderSetImageOutCallback(decoder.get(), &format, Output::callback, &output) != JXL_DEC_SUCCESS) {
+                return Error("jxl: failed to set output callback");
+            }
+            break;
+        case JXL_DEC_FULL_IMAGE:
+            break;
+        case JXL_DEC_SUCCESS:
+            return file;
+        default:
+            return Error("jxl: unknown state");
+        }
+    }
+}
+} // namespace drivers::jxl
@@ -0,0 +1,126 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include <jxl/decode.h>
+#include <jxl/parallel_runner.h>
+
+#include "../../thread-pool.hpp"
+
+namespace drivers::jxl {
+// JxlParallelRunner backed by one pool shared by every decoder in the process
+// so the number of decoding threads is bounded globally, no matter how many files are decoded at once
+// the calling thread works too, so a run completes even if every worker is busy with other runs
+// runs from background threads get no helpers, since the workers would do their work at normal priority
+class ParallelRunner {
+  private:
+    // outlives the run, since queued helpers may start after it returned
+    struct Run {
+        void*                   jpegxl_opaque;
+        JxlParallelRunFunction  func;
+        std::atomic_uint32_t    next;
+        uint32_t                end;
+        std::atomic_size_t      next_thread_id = 1; // 0 is the caller
+        std::mutex              mutex;
+        std::condition_variable condv;
+        size_t                  active = 0;
+        bool                    closed = false;
+
+        auto work(const size_t thread_id) -> void {
+            for(auto value = next.fetch_add(1); value < end; value = next.fetch_add(1)) {
+                func(jpegxl_opaque, value, thread_id);
+            }
+        }
+
+        auto help() -> void {
+            {
+                const auto lock = std::lock_guard(mutex);
+                if(closed) {
+                    return;
+                }
+                active += 1;
+            }
+            work(next_thread_id.fetch_add(1));
+            {
+                const auto lock = std::lock_guard(mutex);
+                active -= 1;
+            }
+            condv.notify_all();
+        }
+    };
+
+    ThreadPool     pool;
+    size_t         threads = std::thread::hardware_concurrency();
+    std::once_flag started;
+
+    inline static thread_local auto background = false;
+
+    static auto runner(void* const runner_opaque, void* const jpegxl_opaque, const JxlParallelRunInit init, const JxlParallelRunFunction func, const uint32_t start_range, const uint32_t end_range) -> JxlParallelRetCode {
+        auto& self = *static_cast<ParallelRunner*>(runner_opaque);
+        if(start_range >= end_range) {
+            return JXL_PARALLEL_RET_SUCCESS;
+        }
+
+        const auto helpers = background ? size_t(0) : std::min(self.threads, size_t(end_range - start_range - 1));
+        if(const auto ret = init(jpegxl_opaque, helpers + 1); ret != JXL_PARALLEL_RET_SUCCESS) {
+            return ret;
+        }
+
+        const auto run     = std::make_shared<Run>();
+        run->jpegxl_opaque = jpegxl_opaque;
+        run->func          = func;
+        run->next          = start_range;
+        run->end           = end_range;
+        for(auto i = size_t(0); i < helpers; i += 1) {
+            self.pool.push([run]() { run->help(); });
+        }
+
+        run->work(0);
+
+        // helpers which have not started yet will not touch the run
+        auto lock   = std::unique_lock(run->mutex);
+        run->closed = true;
+        run->condv.wait(lock, [&run]() { return run->active == 0; });
+        return JXL_PARALLEL_RET_SUCCESS;
+    }
+
+    // the pool is started on first use, since the process may fork before that
+    auto start() -> void {
+        std::call_once(started, [this]() { pool.start(threads); });
+    }
+
+  public:
+    // for the calling thread, which runs low priority work such as prefetching
+    static auto set_background(const bool flag) -> void {
+        background = flag;
+    }
+
+    // must be called before the first decode
+    auto set_threads(const size_t threads) -> void {
+        this->threads = threads;
+    }
+
+    // no-op if the pool has no threads
+    auto attach(JxlDecoder* const decoder) -> bool {
+        if(threads == 0) {
+            return true;
+        }
+        start();
+        return JxlDecoderSetParallelRunner(decoder, runner, this) == JXL_DEC_SUCCESS;
+    }
+
+    // calls func(value, thread_id) for each value in [0, count) on the same workers, for encoders
+    template <class F>
+    auto run(const uint32_t count, F& func) -> void {
+        start();
+        const auto init = [](void* /*opaque*/, size_t /*num_threads*/) -> JxlParallelRetCode { return JXL_PARALLEL_RET_SUCCESS; };
+        const auto call = [](void* const opaque, const uint32_t value, const size_t thread_id) -> void { (*static_cast<F*>(opaque))(value, thread_id); };
+        runner(this, &func, init, call, 0, count);
+    }
+};
+
+inline auto parallel_runner = ParallelRunner();
+} // namespace drivers::jxl
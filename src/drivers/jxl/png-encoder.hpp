@@ -1,22 +1,311 @@
 #pragma once
+#include <array>
+#include <bit>
+#include <cstdlib>
+#include <cstring>
+#include <optional>
+#include <string_view>
+#include <vector>
+
 #include <png.h>
 #include <unistd.h>
+#include <zlib.h>
 
 #include "../../memfd.hpp"
+#include "../../stats.hpp"
 #include "image.hpp"
+#include "parallel-runner.hpp"
 
 namespace drivers::jxl {
-inline auto encode_png(const char* const filename, const Image<4>& image) -> int {
+enum class PngProfile {
+    Fastest,
+    Balanced, // libpng defaults
+    Smallest,
+};
+
+struct PngOptions {
+    PngProfile profile  = PngProfile::Balanced;
+    bool       parallel = false; // compress row strips on the shared workers
+};
+
+struct PngSettings {
+    int level;
+    int strategy;
+    int filters; // PNG_FILTER_*, chosen adaptively per row if more than one
+};
+
+inline auto parse_png_profile(const std::string_view str) -> std::optional<PngProfile> {
+    if(str == "fastest") {
+        return PngProfile::Fastest;
+    } else if(str == "balanced") {
+        return PngProfile::Balanced;
+    } else if(str == "smallest") {
+        return PngProfile::Smallest;
+    }
+    return std::nullopt;
+}
+
+inline auto get_png_profile_name(const PngProfile profile) -> const char* {
+    switch(profile) {
+    case PngProfile::Fastest:
+        return "fastest";
+    case PngProfile::Balanced:
+        return "balanced";
+    case PngProfile::Smallest:
+        return "smallest";
+    }
+    return "";
+}
+
+inline auto get_png_settings(const PngProfile profile) -> PngSettings {
+    switch(profile) {
+    case PngProfile::Fastest:
+        return {1, Z_RLE, PNG_FILTER_SUB};
+    case PngProfile::Balanced:
+        return {6, Z_FILTERED, PNG_ALL_FILTERS};
+    case PngProfile::Smallest:
+        return {9, Z_FILTERED, PNG_ALL_FILTERS};
+    }
+    return {Z_DEFAULT_COMPRESSION, Z_DEFAULT_STRATEGY, PNG_ALL_FILTERS};
+}
+
+namespace png {
+constexpr auto bpp = size_t(4);
+
+inline auto paeth(const int a, const int b, const int c) -> int {
+    const auto p  = a + b - c;
+    const auto pa = std::abs(p - a);
+    const auto pb = std::abs(p - b);
+    const auto pc = std::abs(p - c);
+    return pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+}
+
+// writes filter type and filtered row to out, prev is null for the first row
+inline auto filter_row(uint8_t* const out, const uint8_t* const row, const uint8_t* const prev, const size_t size, const int type) -> void {
+    out[0]        = type;
+    const auto o  = out + 1;
+    const auto up = [prev](const size_t i) -> int { return prev != nullptr ? prev[i] : 0; };
+    for(auto i = size_t(0); i < size; i += 1) {
+        const auto a = i >= bpp ? int(row[i - bpp]) : 0;
+        const auto b = up(i);
+        const auto c = i >= bpp ? up(i - bpp) : 0;
+        switch(type) {
+        case 0:
+            o[i] = row[i];
+            break;
+        case 1:
+            o[i] = row[i] - a;
+            break;
+        case 2:
+            o[i] = row[i] - b;
+            break;
+        case 3:
+            o[i] = row[i] - (a + b) / 2;
+            break;
+        case 4:
+            o[i] = row[i] - paeth(a, b, c);
+            break;
+        }
+    }
+}
+
+// same heuristic as libpng, minimum sum of absolute values
+inline auto filter_row_adaptive(uint8_t* const out, uint8_t* const scratch, const uint8_t* const row, const uint8_t* const prev, const size_t size, const int filters) -> void {
+    constexpr auto flags = std::array{PNG_FILTER_NONE, PNG_FILTER_SUB, PNG_FILTER_UP, PNG_FILTER_AVG, PNG_FILTER_PAETH};
+
+    auto best = std::optional<size_t>();
+    for(auto type = 0; type < int(flags.size()); type += 1) {
+        if(!(filters & flags[type])) {
+            continue;
+        }
+        filter_row(scratch, row, prev, size, type);
+        auto sum = size_t(0);
+        for(auto i = size_t(1); i <= size; i += 1) {
+            sum += std::abs(int(int8_t(scratch[i])));
+        }
+        if(!best || sum < *best) {
+            best = sum;
+            std::memcpy(out, scratch, size + 1);
+        }
+    }
+}
+
+// libpng output collected in memory, written to the file at once
+struct WriteBuffer {
+    std::vector<std::byte> data;
+
+    auto append(const png_bytep bytes, const png_size_t length) -> bool {
+        try {
+            data.insert(data.end(), std::bit_cast<const std::byte*>(bytes), std::bit_cast<const std::byte*>(bytes) + length);
+            return true;
+        } catch(const std::bad_alloc&) {
+            return false;
+        }
+    }
+
+    // png_error() longjmps, so it must not be called from within the catch block
+    static auto write_callback(const png_structp png, const png_bytep data, const png_size_t length) -> void {
+        stats.png_chunks += 1;
+        if(!static_cast<WriteBuffer*>(png_get_io_ptr(png))->append(data, length)) {
+            png_error(png, "out of memory");
+        }
+    }
+
+    static auto flush_callback(const png_structp /*png*/) -> void {}
+};
+
+inline auto append_chunk(std::vector<std::byte>& out, const char* const type, const std::byte* const data, const size_t size) -> void {
+    const auto put32 = [&out](const uint32_t v) {
+        for(auto shift = 24; shift >= 0; shift -= 8) {
+            out.push_back(std::byte(v >> shift));
+        }
+    };
+
+    put32(size);
+    const auto begin = out.size();
+    out.insert(out.end(), std::bit_cast<const std::byte*>(type), std::bit_cast<const std::byte*>(type) + 4);
+    out.insert(out.end(), data, data + size);
+    put32(crc32(0, std::bit_cast<const Bytef*>(out.data() + begin), out.size() - begin));
+}
+} // namespace png
+
+// compresses row strips independently into one zlib stream, like pigz
+// each strip is primed with the last 32KiB of the previous one, so the size penalty is small
+inline auto encode_png_parallel(const char* const filename, const Image<4>& image, const PngSettings& settings) -> int {
+    constexpr auto strip_bytes = size_t(1) << 18;
+    constexpr auto window_size = size_t(1) << 15;
+
+    if(image.width == 0 || image.height == 0) {
+        return -1;
+    }
+    const auto row_size     = image.width * png::bpp;
+    const auto filtered_row = row_size + 1;
+    const auto strip_rows   = std::max(size_t(1), strip_bytes / filtered_row);
+    const auto strips       = (image.height + strip_rows - 1) / strip_rows;
+
+    const auto pixels   = std::bit_cast<const uint8_t*>(image.buffer.data());
+    auto       filtered = std::vector<uint8_t>(filtered_row * image.height);
+
+    struct Strip {
+        std::vector<std::byte> deflated;
+        uLong                  adler;
+        bool                   ok;
+    };
+    auto results = std::vector<Strip>(strips);
+
+    auto filter = [&](const uint32_t strip, size_t /*thread_id*/) {
+        const auto single  = (settings.filters & (settings.filters - 1)) == 0;
+        auto       scratch = std::vector<uint8_t>(single ? 0 : filtered_row);
+        const auto end     = std::min(image.height, (strip + 1) * strip_rows);
+        for(auto r = strip * strip_rows; r < end; r += 1) {
+            const auto out  = filtered.data() + r * filtered_row;
+            const auto row  = pixels + r * row_size;
+            const auto prev = r == 0 ? nullptr : row - row_size;
+            if(single) {
+                png::filter_row(out, row, prev, row_size, std::countr_zero(unsigned(settings.filters)) - 3);
+            } else {
+                png::filter_row_adaptive(out, scratch.data(), row, prev, row_size, settings.filters);
+            }
+        }
+    };
+
+    auto compress = [&](const uint32_t strip, size_t /*thread_id*/) {
+        auto&      result = results[strip];
+        const auto begin  = strip * strip_rows * filtered_row;
+        const auto end    = std::min(image.height, (strip + 1) * strip_rows) * filtered_row;
+        const auto last   = strip + 1 == strips;
+
+        auto stream = z_stream();
+        if(deflateInit2(&stream, settings.level, Z_DEFLATED, -15, 8, settings.strategy) != Z_OK) {
+            result.ok = false;
+            return;
+        }
+        if(begin != 0) {
+            const auto dict = std::min(begin, window_size);
+            deflateSetDictionary(&stream, filtered.data() + begin - dict, dict);
+        }
+
+        result.deflated.resize(deflateBound(&stream, end - begin) + 64);
+        stream.next_in   = filtered.data() + begin;
+        stream.avail_in  = end - begin;
+        stream.next_out  = std::bit_cast<Bytef*>(result.deflated.data());
+        stream.avail_out = result.deflated.size();
+        // sync flush ends on a byte boundary without the final block bit, so strips can be concatenated
+        const auto ret = deflate(&stream, last ? Z_FINISH : Z_SYNC_FLUSH);
+        result.ok      = last ? ret == Z_STREAM_END : ret == Z_OK && stream.avail_in == 0;
+        result.deflated.resize(result.deflated.size() - stream.avail_out);
+        result.adler = adler32(adler32(0, NULL, 0), filtered.data() + begin, end - begin);
+        deflateEnd(&stream);
+    };
+
+    parallel_runner.run(strips, filter);
+    parallel_runner.run(strips, compress);
+
+    auto png   = std::vector<std::byte>();
+    auto adler = adler32(0, NULL, 0);
+    {
+        constexpr auto signature = std::array<uint8_t, 8>{0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+        png.insert(png.end(), std::bit_cast<const std::byte*>(signature.data()), std::bit_cast<const std::byte*>(signature.data()) + signature.size());
+
+        auto ihdr = std::array<std::byte, 13>();
+        for(auto i = 0; i < 4; i += 1) {
+            ihdr[i]     = std::byte(image.width >> (24 - i * 8));
+            ihdr[4 + i] = std::byte(image.height >> (24 - i * 8));
+        }
+        ihdr[8]  = std::byte(8);                    // bit depth
+        ihdr[9]  = std::byte(PNG_COLOR_TYPE_RGBA);  // color type
+        ihdr[10] = std::byte(0);                    // compression
+        ihdr[11] = std::byte(0);                    // filter
+        ihdr[12] = std::byte(0);                    // interlace
+        png::append_chunk(png, "IHDR", ihdr.data(), ihdr.size());
+    }
+    for(auto i = size_t(0); i < strips; i += 1) {
+        auto& strip = results[i];
+        if(!strip.ok) {
+            return -1;
+        }
+        const auto len = std::min(image.height, (i + 1) * strip_rows) * filtered_row - i * strip_rows * filtered_row;
+        adler          = adler32_combine(adler, strip.adler, len);
+        if(i == 0) {
+            // zlib header, with the level hint of the compression level
+            const auto flags = settings.level == 1 ? 0x01 : settings.level < 6 ? 0x5e : settings.level == 6 ? 0x9c : 0xda;
+            strip.deflated.insert(strip.deflated.begin(), {std::byte(0x78), std::byte(flags)});
+        }
+        if(i + 1 == strips) {
+            for(auto shift = 24; shift >= 0; shift -= 8) {
+                strip.deflated.push_back(std::byte(adler >> shift));
+            }
+        }
+        png::append_chunk(png, "IDAT", strip.deflated.data(), strip.deflated.size());
+    }
+    png::append_chunk(png, "IEND", nullptr, 0);
+
+    auto file = open_memory_fd(filename);
+    stats.png_writes += 1;
+    if(!file || !file.write(png.data(), png.size())) {
+        return -1;
+    }
+    return file.release();
+}
+
+inline auto encode_png(const char* const filename, const Image<4>& image, const PngOptions& options = {}) -> int {
     static_assert(sizeof(png_byte) == sizeof(uint8_t), "png_byte is not 8-bit");
 
+    const auto settings = get_png_settings(options.profile);
+    if(options.parallel) {
+        return encode_png_parallel(filename, image, settings);
+    }
+
     auto file = open_memory_fd(filename);
     if(!file) {
         return -1;
     }
 
-    auto rows = png_bytepp(NULL);
-    auto png  = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-    auto info = png_create_info_struct(png);
+    auto buffer  = png::WriteBuffer();
+    auto encoded = false;
+    auto rows    = png_bytepp(NULL);
+    auto png     = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    auto info    = png_create_info_struct(png);
     if(png == NULL || info == NULL) {
         goto end;
     }
@@ -24,15 +313,11 @@ inline auto encode_png(const char* const filename, const Image<4>& image) -> int
         goto end;
     }
 
-    struct WriteCallback {
-        static auto write_callback(const png_structp png, const png_bytep data, const png_size_t length) -> void {
-            const auto fd = static_cast<int>((uintptr_t)png_get_io_ptr(png));
-            write(fd, data, length);
-        }
-    };
-
-    png_set_write_fn(png, reinterpret_cast<void*>(file.as_handle()), WriteCallback::write_callback, NULL);
+    png_set_write_fn(png, &buffer, png::WriteBuffer::write_callback, png::WriteBuffer::flush_callback);
     png_set_IHDR(png, info, image.width, image.height, 8, PNG_COLOR_TYPE_RGBA, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+    png_set_compression_level(png, settings.level);
+    png_set_compression_strategy(png, settings.strategy);
+    png_set_filter(png, PNG_FILTER_TYPE_BASE, settings.filters);
     rows = reinterpret_cast<png_bytepp>(png_malloc(png, sizeof(png_bytep) * image.height));
     if(rows == NULL) {
         goto end;
@@ -42,6 +327,7 @@ inline auto encode_png(const char* const filename, const Image<4>& image) -> int
         rows[r] = std::bit_cast<png_bytep>(image.buffer.data() + r * image.width * 4);
     }
     png_write_png(png, info, PNG_TRANSFORM_IDENTITY, NULL);
+    encoded = true;
 
 end:
     if(rows != NULL) {
@@ -50,6 +336,13 @@ end:
     if(png != NULL) {
         png_destroy_write_struct(&png, &info);
     }
+    if(!encoded) {
+        return -1;
+    }
+    stats.png_writes += 1;
+    if(!file.write(buffer.data.data(), buffer.data.size())) {
+        return -1;
+    }
     return file.release();
 }
 } // namespace drivers::jxl
@@ -0,0 +1,78 @@
+#pragma once
+#include <bit>
+#include <cstddef>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RWFS_SWIZZLE_X86
+#endif
+
+namespace drivers::jxl {
+namespace swizzle {
+using Kernel = void (*)(std::byte* dst, const std::byte* src, size_t pixels);
+
+inline auto rgba_to_bgra_scalar(std::byte* dst, const std::byte* src, const size_t pixels) -> void {
+    for(auto i = size_t(0); i < pixels; i += 1) {
+        const auto r = src[0];
+        const auto b = src[2];
+        dst[0]       = b;
+        dst[1]       = src[1];
+        dst[2]       = r;
+        dst[3]       = src[3];
+        src += 4;
+        dst += 4;
+    }
+}
+
+#if defined(RWFS_SWIZZLE_X86)
+// compiled for these instruction sets regardless of build flags, and selected at runtime
+__attribute__((target("ssse3"))) inline auto rgba_to_bgra_ssse3(std::byte* dst, const std::byte* src, const size_t pixels) -> void {
+    const auto mask = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+
+    auto i = size_t(0);
+    for(; i + 4 <= pixels; i += 4) {
+        const auto v = _mm_loadu_si128(std::bit_cast<const __m128i*>(src));
+        _mm_storeu_si128(std::bit_cast<__m128i*>(dst), _mm_shuffle_epi8(v, mask));
+        src += 16;
+        dst += 16;
+    }
+    rgba_to_bgra_scalar(dst, src, pixels - i);
+}
+
+__attribute__((target("avx2"))) inline auto rgba_to_bgra_avx2(std::byte* dst, const std::byte* src, const size_t pixels) -> void {
+    const auto mask = _mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+                                       2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+
+    auto i = size_t(0);
+    for(; i + 16 <= pixels; i += 16) {
+        const auto a = _mm256_loadu_si256(std::bit_cast<const __m256i*>(src));
+        const auto b = _mm256_loadu_si256(std::bit_cast<const __m256i*>(src + 32));
+        _mm256_storeu_si256(std::bit_cast<__m256i*>(dst), _mm256_shuffle_epi8(a, mask));
+        _mm256_storeu_si256(std::bit_cast<__m256i*>(dst + 32), _mm256_shuffle_epi8(b, mask));
+        src += 64;
+        dst += 64;
+    }
+    rgba_to_bgra_ssse3(dst, src, pixels - i);
+}
+#endif
+
+inline auto select_rgba_to_bgra() -> Kernel {
+#if defined(RWFS_SWIZZLE_X86)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")) {
+        return rgba_to_bgra_avx2;
+    }
+    if(__builtin_cpu_supports("ssse3")) {
+        return rgba_to_bgra_ssse3;
+    }
+#endif
+    return rgba_to_bgra_scalar;
+}
+} // namespace swizzle
+
+// swaps red and blue of pixels, dst and src may be the same
+inline auto rgba_to_bgra(std::byte* const dst, const std::byte* const src, const size_t pixels) -> void {
+    static const auto kernel = swizzle::select_rgba_to_bgra();
+    kernel(dst, src, pixels);
+}
+} // namespace drivers::jxl
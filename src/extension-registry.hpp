@@ -0,0 +1,124 @@
+#pragma once
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <tuple>
+#include <utility>
+
+// maps file extensions declared by drivers to their index in the driver tuple
+// the table is built at compile time with a seed that makes the hash collision free, so a lookup is one hash and one compare
+namespace extension_registry {
+// ".png" of "/dir/image.png", empty if there is none
+constexpr auto get_extension(const std::string_view path) -> std::string_view {
+    const auto dot = path.rfind('.');
+    if(dot == path.npos) {
+        return {};
+    }
+    const auto slash = path.rfind('/');
+    if(slash != path.npos && slash > dot) {
+        return {};
+    }
+    return path.substr(dot);
+}
+
+// fnv-1a
+constexpr auto hash(const std::string_view str, const uint32_t seed) -> uint32_t {
+    auto h = uint32_t(2166136261u) ^ seed;
+    for(const auto c : str) {
+        h ^= uint8_t(c);
+        h *= uint32_t(16777619u);
+    }
+    return h;
+}
+
+struct Entry {
+    std::string_view extension; // empty if unused
+    size_t           driver = 0;
+};
+
+template <size_t count>
+class Table {
+  private:
+    constexpr static auto size = std::bit_ceil(count * 2 + 1);
+
+    std::array<Entry, size> slots = {};
+    uint32_t                seed  = 0;
+
+    constexpr auto try_build(const std::array<Entry, count>& entries) -> bool {
+        slots = {};
+        for(const auto& entry : entries) {
+            auto& slot = slots[hash(entry.extension, seed) % size];
+            if(!slot.extension.empty()) {
+                return false;
+            }
+            slot = entry;
+        }
+        return true;
+    }
+
+  public:
+    constexpr auto find(const std::string_view extension) const -> std::optional<size_t> {
+        if(extension.empty()) {
+            return std::nullopt;
+        }
+        const auto& slot = slots[hash(extension, seed) % size];
+        if(slot.extension != extension) {
+            return std::nullopt;
+        }
+        return slot.driver;
+    }
+
+    // fails to compile on duplicated or empty extensions
+    constexpr Table(const std::array<Entry, count>& entries) {
+        for(auto i = size_t(0); i < count; i += 1) {
+            if(entries[i].extension.empty()) {
+                throw "empty extension";
+            }
+            for(auto j = i + 1; j < count; j += 1) {
+                if(entries[i].extension == entries[j].extension) {
+                    throw "extension claimed by multiple drivers";
+                }
+            }
+        }
+        while(!try_build(entries)) {
+            seed += 1;
+        }
+    }
+};
+
+template <class Drivers, size_t... I>
+constexpr auto collect_source_extensions(std::index_sequence<I...>) -> std::array<Entry, sizeof...(I)> {
+    return {Entry{std::tuple_element_t<I, Drivers>::source_extension, I}...};
+}
+
+template <class Drivers, size_t... I>
+constexpr auto collect_phantom_extensions(std::index_sequence<I...>) {
+    constexpr auto count = (size_t(0) + ... + std::tuple_element_t<I, Drivers>::phantom_extensions.size());
+
+    auto entries = std::array<Entry, count>();
+    auto n       = size_t(0);
+    (
+        [&]() {
+            for(const auto extension : std::tuple_element_t<I, Drivers>::phantom_extensions) {
+                entries[n] = Entry{extension, I};
+                n += 1;
+            }
+        }(),
+        ...);
+    return entries;
+}
+
+// real file extension -> driver
+template <class Drivers>
+constexpr auto make_source_table() {
+    return Table(collect_source_extensions<Drivers>(std::make_index_sequence<std::tuple_size_v<Drivers>>()));
+}
+
+// phantom file extension -> driver
+template <class Drivers>
+constexpr auto make_phantom_table() {
+    return Table(collect_phantom_extensions<Drivers>(std::make_index_sequence<std::tuple_size_v<Drivers>>()));
+}
+} // namespace extension_registry
@@ -1,3 +1,4 @@
 #pragma once
 #define FUSE_USE_VERSION 31
 #include <fuse3/fuse.h>
+#include <fuse3/fuse_lowlevel.h>
@@ -0,0 +1,91 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// objects referred to by integer handles, such as fuse_file_info::fh
+// slots are allocated in chunks which never move, so get() takes no lock
+// only insert() and erase() take the lock, and freed handles are reused
+template <class T>
+class HandleTable {
+  private:
+    constexpr static auto chunk_size = size_t(1024);
+    constexpr static auto max_chunks = size_t(1024);
+
+    using Chunk = std::array<std::atomic<T*>, chunk_size>;
+
+    std::array<std::atomic<Chunk*>, max_chunks> chunks = {};
+    std::mutex                                  mutex;
+    std::vector<uint64_t>                       free_handles;
+    uint64_t                                    next = 1; // 0 is never a valid handle
+
+  public:
+    // returns 0 if the table is full
+    auto insert(std::unique_ptr<T> object) -> uint64_t {
+        const auto lock   = std::lock_guard(mutex);
+        auto       handle = uint64_t(0);
+        if(!free_handles.empty()) {
+            handle = free_handles.back();
+            free_handles.pop_back();
+        } else {
+            if(next >= chunk_size * max_chunks) {
+                return 0;
+            }
+            handle = next;
+            next += 1;
+        }
+
+        auto& chunk = chunks[handle / chunk_size];
+        if(chunk.load(std::memory_order_relaxed) == nullptr) {
+            chunk.store(new Chunk(), std::memory_order_release);
+        }
+        (*chunk.load(std::memory_order_relaxed))[handle % chunk_size].store(object.release(), std::memory_order_release);
+        return handle;
+    }
+
+    // null if the handle is not in use
+    auto get(const uint64_t handle) const -> T* {
+        if(handle >= chunk_size * max_chunks) {
+            return nullptr;
+        }
+        const auto chunk = chunks[handle / chunk_size].load(std::memory_order_acquire);
+        if(chunk == nullptr) {
+            return nullptr;
+        }
+        return (*chunk)[handle % chunk_size].load(std::memory_order_acquire);
+    }
+
+    // the caller must make sure that no one uses the object any more
+    auto erase(const uint64_t handle) -> std::unique_ptr<T> {
+        const auto lock  = std::lock_guard(mutex);
+        const auto chunk = handle < chunk_size * max_chunks ? chunks[handle / chunk_size].load(std::memory_order_relaxed) : nullptr;
+        if(chunk == nullptr) {
+            return nullptr;
+        }
+        auto object = std::unique_ptr<T>((*chunk)[handle % chunk_size].exchange(nullptr));
+        if(object) {
+            free_handles.push_back(handle);
+        }
+        return object;
+    }
+
+    HandleTable()                                      = default;
+    HandleTable(const HandleTable&)                    = delete;
+    auto operator=(const HandleTable&) -> HandleTable& = delete;
+
+    ~HandleTable() {
+        for(auto& chunk : chunks) {
+            const auto ptr = chunk.load();
+            if(ptr == nullptr) {
+                continue;
+            }
+            for(auto& slot : *ptr) {
+                delete slot.load();
+            }
+            delete ptr;
+        }
+    }
+};
@@ -0,0 +1,253 @@
+#pragma once
+#include <algorithm>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "fuse.hpp"
+#include "util/fd.hpp"
+#include "util/string-map.hpp"
+
+// node ids handed to the kernel by the low-level backend
+// an inode is a name in its parent directory, so renaming a directory does not touch anything below it
+// directories keep an O_PATH descriptor, so that requests can use *at() calls instead of walking whole paths
+// inodes remember the identity of the file they were looked up as, so that an entry replaced outside of the mount gets a new id
+class InodeTable {
+  public:
+    using DirFd = std::shared_ptr<const FileDescriptor>;
+
+    struct Location {
+        fuse_ino_t  parent; // 0 for the root
+        DirFd       dir;    // of the parent
+        std::string name;
+    };
+
+  private:
+    struct Inode {
+        fuse_ino_t            parent = 0; // 0 if unlinked
+        std::string           name;
+        uint64_t              lookups = 0;
+        dev_t                 dev     = 0;
+        ino_t                 ino     = 0;
+        DirFd                 fd;       // directories only, opened on first use
+        StringMap<fuse_ino_t> children; // entries known to the kernel
+    };
+
+    static auto is_same_file(const Inode& inode, const struct stat& st) -> bool {
+        return inode.dev == st.st_dev && inode.ino == st.st_ino;
+    }
+
+    std::unordered_map<fuse_ino_t, Inode> inodes;
+    fuse_ino_t                            next_id = FUSE_ROOT_ID + 1; // never reused, so generations are not needed
+
+    auto find(const fuse_ino_t id) -> Inode* {
+        const auto p = inodes.find(id);
+        return p != inodes.end() ? &p->second : nullptr;
+    }
+
+    // an inode lives while the kernel remembers it or any of its children
+    auto try_erase(fuse_ino_t id) -> void {
+        while(id != FUSE_ROOT_ID) {
+            const auto p = inodes.find(id);
+            if(p == inodes.end() || p->second.lookups != 0 || !p->second.children.empty()) {
+                return;
+            }
+            const auto parent = p->second.parent;
+            if(const auto dir = find(parent)) {
+                dir->children.erase(p->second.name);
+            }
+            inodes.erase(p);
+            id = parent;
+        }
+    }
+
+    auto detach(const fuse_ino_t parent, const std::string_view name) -> void {
+        const auto dir = find(parent);
+        if(dir == nullptr) {
+            return;
+        }
+        const auto p = dir->children.find(name);
+        if(p == dir->children.end()) {
+            return;
+        }
+        const auto id = p->second;
+        dir->children.erase(p);
+        if(const auto inode = find(id)) {
+            inode->parent = 0;
+        }
+        try_erase(id);
+    }
+
+  public:
+    auto init(FileDescriptor root) -> void {
+        inodes.clear();
+        auto& inode = inodes[FUSE_ROOT_ID];
+        if(struct stat st; fstat(root.as_handle(), &st) == 0) {
+            inode.dev = st.st_dev;
+            inode.ino = st.st_ino;
+        }
+        inode.fd      = std::make_shared<const FileDescriptor>(std::move(root));
+        inode.lookups = 1;
+    }
+
+    // increments the lookup count of the entry, adding it if it is new
+    // st is the current stat of the entry, an entry which is another file now is replaced with a new inode
+    // returns 0 if parent is unknown
+    auto lookup(const fuse_ino_t parent, const std::string_view name, const struct stat& st) -> fuse_ino_t {
+        auto dir = find(parent);
+        if(dir == nullptr) {
+            return 0;
+        }
+        if(const auto p = dir->children.find(name); p != dir->children.end()) {
+            auto& inode = inodes[p->second];
+            if(is_same_file(inode, st)) {
+                inode.lookups += 1;
+                return p->second;
+            }
+            detach(parent, name);
+            dir = find(parent); // detach may erase inodes without children
+            if(dir == nullptr) {
+                return 0;
+            }
+        }
+        const auto id = next_id;
+        next_id += 1;
+        auto& inode   = inodes[id]; // references to other elements stay valid
+        inode.parent  = parent;
+        inode.name    = name;
+        inode.lookups = 1;
+        inode.dev     = st.st_dev;
+        inode.ino     = st.st_ino;
+        dir->children.emplace(std::string(name), id);
+        return id;
+    }
+
+    auto forget(const fuse_ino_t id, const uint64_t count) -> void {
+        const auto inode = find(id);
+        if(inode == nullptr) {
+            return;
+        }
+        inode->lookups -= std::min(inode->lookups, count);
+        try_erase(id);
+    }
+
+    auto unlink(const fuse_ino_t parent, const std::string_view name) -> void {
+        detach(parent, name);
+    }
+
+    auto rename(const fuse_ino_t parent, const std::string_view name, const fuse_ino_t new_parent, const std::string_view new_name) -> void {
+        detach(new_parent, new_name);
+        const auto dir     = find(parent);
+        const auto new_dir = find(new_parent);
+        if(dir == nullptr || new_dir == nullptr) {
+            return;
+        }
+        const auto p = dir->children.find(name);
+        if(p == dir->children.end()) {
+            return;
+        }
+        const auto id = p->second;
+        dir->children.erase(p);
+        auto& inode  = inodes[id];
+        inode.parent = new_parent;
+        inode.name   = new_name;
+        new_dir->children.emplace(std::string(new_name), id);
+        try_erase(parent);
+    }
+
+    // descriptor of a directory inode
+    auto get_dir_fd(const fuse_ino_t id) -> DirFd {
+        const auto inode = find(id);
+        if(inode == nullptr) {
+            return nullptr;
+        }
+        if(inode->fd) {
+            return inode->fd;
+        }
+        const auto parent_fd = inode->parent != 0 ? get_dir_fd(inode->parent) : nullptr;
+        if(!parent_fd) {
+            return nullptr;
+        }
+        auto fd = FileDescriptor(openat(parent_fd->as_handle(), inode->name.data(), O_PATH | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC));
+        if(!fd) {
+            return nullptr;
+        }
+        // the name may refer to another directory than the one looked up
+        if(struct stat st; fstat(fd.as_handle(), &st) == -1 || !is_same_file(*inode, st)) {
+            return nullptr;
+        }
+        inode->fd = std::make_shared<const FileDescriptor>(std::move(fd));
+        return inode->fd;
+    }
+
+    // the root is "." in itself
+    auto get_location(const fuse_ino_t id) -> std::optional<Location> {
+        if(id == FUSE_ROOT_ID) {
+            return Location{0, find(id)->fd, "."};
+        }
+        const auto inode = find(id);
+        if(inode == nullptr || inode->parent == 0) {
+            return std::nullopt;
+        }
+        auto dir = get_dir_fd(inode->parent);
+        if(!dir) {
+            return std::nullopt;
+        }
+        return Location{inode->parent, std::move(dir), inode->name};
+    }
+
+    // "/dir/file", as the high-level backend sees it
+    auto get_path(fuse_ino_t id) -> std::optional<std::string> {
+        auto names = std::vector<const std::string*>();
+        while(id != FUSE_ROOT_ID) {
+            const auto inode = find(id);
+            if(inode == nullptr || inode->parent == 0) {
+                return std::nullopt;
+            }
+            names.push_back(&inode->name);
+            id = inode->parent;
+        }
+        if(names.empty()) {
+            return "/";
+        }
+        auto path = std::string();
+        for(auto i = names.rbegin(); i != names.rend(); i = std::next(i)) {
+            path += "/";
+            path += **i;
+        }
+        return path;
+    }
+
+    // {parent, inode} of a path, if the kernel knows it
+    auto find_path(const std::string_view path) -> std::optional<std::pair<fuse_ino_t, fuse_ino_t>> {
+        auto parent = fuse_ino_t(0);
+        auto id     = fuse_ino_t(FUSE_ROOT_ID);
+        auto rest   = path;
+        while(!rest.empty()) {
+            if(rest.front() == '/') {
+                rest.remove_prefix(1);
+                continue;
+            }
+            const auto name = rest.substr(0, rest.find('/'));
+            rest.remove_prefix(name.size());
+
+            const auto dir = find(id);
+            if(dir == nullptr) {
+                return std::nullopt;
+            }
+            const auto p = dir->children.find(name);
+            if(p == dir->children.end()) {
+                return std::nullopt;
+            }
+            parent = id;
+            id     = p->second;
+        }
+        return std::pair{parent, id};
+    }
+};
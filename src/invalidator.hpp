@@ -0,0 +1,72 @@
+#pragma once
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// drops kernel attribute and page caches of paths
+// notifications are sent from a dedicated thread, since sending them from the request
+// which caused the invalidation may deadlock in the kernel
+class KernelInvalidator {
+  public:
+    // sends the notifications for a path, which may be unknown to the kernel
+    using Invalidate = std::function<void(const std::string& path)>;
+
+  private:
+    Invalidate               invalidate;
+    std::thread              thread;
+    std::mutex               mutex;
+    std::condition_variable  condv;
+    std::vector<std::string> queue;
+    bool                     exiting = false;
+
+    auto run() -> void {
+        auto paths = std::vector<std::string>();
+        while(true) {
+            {
+                auto lock = std::unique_lock(mutex);
+                condv.wait(lock, [this]() { return exiting || !queue.empty(); });
+                if(exiting) {
+                    return;
+                }
+                std::swap(paths, queue);
+            }
+            for(const auto& path : paths) {
+                invalidate(path);
+            }
+            paths.clear();
+        }
+    }
+
+  public:
+    auto push(std::string path) -> void {
+        {
+            const auto lock = std::lock_guard(mutex);
+            queue.emplace_back(std::move(path));
+        }
+        condv.notify_one();
+    }
+
+    auto start(Invalidate invalidate) -> void {
+        this->invalidate = std::move(invalidate);
+        thread           = std::thread(&KernelInvalidator::run, this);
+    }
+
+    auto stop() -> void {
+        if(!thread.joinable()) {
+            return;
+        }
+        {
+            const auto lock = std::lock_guard(mutex);
+            exiting         = true;
+        }
+        condv.notify_one();
+        thread.join();
+    }
+
+    ~KernelInvalidator() {
+        stop();
+    }
+};
@@ -1,20 +1,35 @@
+#include <algorithm>
 #include <filesystem>
+#include <future>
 #include <iostream>
 #include <variant>
 
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/xattr.h>
 #include <unistd.h>
 
+#include "cache.hpp"
+#include "disk-cache.hpp"
 #include "drivers/flac/driver.hpp"
 #include "drivers/jxl/driver.hpp"
+#include "extension-registry.hpp"
 #include "fuse.hpp"
+#include "handle-table.hpp"
+#include "inode-table.hpp"
+#include "invalidator.hpp"
+#include "options.hpp"
+#include "path-cache.hpp"
+#include "stats.hpp"
+#include "thread-pool.hpp"
 #include "util/string-map.hpp"
 #include "util/thread.hpp"
+#include "watcher.hpp"
 
 using Stat    = struct stat;
 using Statvfs = struct statvfs;
@@ -45,158 +60,715 @@ using Drivers = std::tuple<drivers::jxl::Driver, drivers::flac::Driver>;
 
 namespace {
 auto root    = std::string();
+auto options = Options();
 auto drivers = Drivers();
 
-using DecodedCache = StringMap<FileDescriptor>;
+auto decoded_cache          = DecodedCache();
+auto critical_size_cache    = Critical<SizeCache>();
+auto disk_cache             = std::optional<DiskCache>();
+auto watcher                = std::optional<Watcher>();
+auto invalidator            = KernelInvalidator();
+auto critical_path_cache    = Critical<PathCache>();
 
-auto critical_decoded_cache = Critical<DecodedCache>();
+struct DecodeResult {
+    std::shared_ptr<CachedFile> file;
+    int                         error; // errno, if file is null
+};
 
-template <size_t N>
-auto to_real_path(const std::string_view path) -> WeakString {
-    if constexpr(N < std::tuple_size_v<Drivers>) {
-        auto& driver = std::get<N>(drivers);
-        auto  result = driver.get_real_path(path);
-        if(result) {
-            return result.value();
+using InFlightDecodes = StringMap<std::shared_future<DecodeResult>>;
+
+auto critical_in_flight = Critical<InFlightDecodes>();
+
+// per-open state, referred to by fuse_file_info::fh
+class Handle {
+  private:
+    int                            fd = -1;
+    std::shared_ptr<CachedFile>    cached; // keeps the cache entry pinned while opened
+    std::shared_ptr<PhantomStream> stream; // shared by opens of the same file
+    bool                           reused      = false; // cached file was generated by an earlier open
+    std::atomic_bool               written     = false;
+    std::atomic<off_t>             next_offset = 0; // end of the last read
+    std::atomic_bool               sequential  = false;
+
+  public:
+    auto get_fd() const -> int {
+        return fd;
+    }
+
+    // generated from a source, instead of opened from a real file
+    auto is_phantom() const -> bool {
+        return cached || stream;
+    }
+
+    auto get_size() const -> ssize_t {
+        if(cached) {
+            return cached->size;
+        }
+        if(stream) {
+            return stream->get_size();
+        }
+        auto st = Stat();
+        return ::fstat(fd, &st) == -1 ? -1 : st.st_size;
+    }
+
+    // asks for more read-ahead once a real file is read sequentially
+    // decoded files are in memory already
+    auto on_read(const off_t offset, const size_t size) -> void {
+        if(cached || stream || sequential) {
+            return;
+        }
+        if(next_offset.exchange(offset + off_t(size)) == offset && offset != 0 && !sequential.exchange(true)) {
+            ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        }
+    }
+
+    auto read(char* const buf, const size_t size, const off_t offset) const -> ssize_t {
+        if(stream) {
+            return stream->read(std::bit_cast<std::byte*>(buf), size, offset);
+        }
+        return ::pread(fd, buf, size, offset);
+    }
+
+    // the kernel may keep its page cache only if the content is the same as the last open
+    auto is_reused() const -> bool {
+        return reused;
+    }
+
+    // returns true only on the first call
+    auto mark_written() -> bool {
+        return !written.exchange(true);
+    }
+
+    auto is_written() const -> bool {
+        return written;
+    }
+
+    Handle(const int fd) : fd(fd) {}
+
+    Handle(std::shared_ptr<CachedFile> cached, const bool reused = false) : fd(cached->fd.as_handle()), cached(std::move(cached)), reused(reused) {}
+
+    Handle(std::shared_ptr<PhantomStream> stream) : stream(std::move(stream)) {}
+
+    Handle(const Handle&)                    = delete;
+    auto operator=(const Handle&) -> Handle& = delete;
+
+    ~Handle() {
+        if(!cached && fd != -1) {
+            ::close(fd);
         }
-        return to_real_path<N + 1>(path);
-    } else {
-        return path;
     }
+};
+
+// fh of open files, kept valid by the kernel until release
+auto handles = HandleTable<Handle>();
+
+auto to_handle(const fuse_file_info* const fi) -> Handle& {
+    return *handles.get(fi->fh);
 }
 
-auto to_real_path(const std::string_view path) -> WeakString {
+// returns 0 if there are too many open files
+auto to_fh(std::unique_ptr<Handle> handle) -> uint64_t {
+    return handles.insert(std::move(handle));
+}
+
+auto release_fh(const fuse_file_info* const fi) -> std::unique_ptr<Handle> {
+    return handles.erase(fi->fh);
+}
+
+constexpr auto source_extensions  = extension_registry::make_source_table<Drivers>();
+constexpr auto phantom_extensions = extension_registry::make_phantom_table<Drivers>();
+
+// calls func with the driver at index, through a table instead of comparing the index with each driver
+template <class F, size_t... I>
+auto visit_driver(const size_t index, F&& func, std::index_sequence<I...>) -> decltype(auto) {
+    using Ret   = decltype(func(std::get<0>(drivers)));
+    using Thunk = Ret (*)(F&);
+
+    constexpr static auto thunks = std::array<Thunk, sizeof...(I)>{[](F& func) -> Ret { return func(std::get<I>(drivers)); }...};
+    return thunks[index](func);
+}
+
+template <class F>
+auto visit_driver(const size_t index, F&& func) -> decltype(auto) {
+    return visit_driver(index, func, std::make_index_sequence<std::tuple_size_v<Drivers>>());
+}
+
+// driver which generates the phantom file at path
+auto find_phantom_driver(const std::string_view path) -> std::optional<size_t> {
+    return phantom_extensions.find(extension_registry::get_extension(path));
+}
+
+auto resolve_uncached(const std::string_view path) -> Resolution {
     if(std::filesystem::exists(path)) {
+        return {std::string(path), std::nullopt};
+    }
+    const auto index = find_phantom_driver(path);
+    if(!index) {
+        return {};
+    }
+    auto real_path = visit_driver(*index, [path](const auto& driver) { return driver.get_real_path(path); });
+    if(!real_path) {
+        return {};
+    }
+    return {std::move(real_path.value()), *index};
+}
+
+// one stat of the parent directory on hit, instead of probing every driver
+auto resolve(const std::string_view path) -> Resolution {
+    stats.path_lookups += 1;
+    if(!options.path_cache) {
+        return resolve_uncached(path);
+    }
+
+    const auto slash = path.rfind('/');
+    if(slash == path.npos) {
+        return resolve_uncached(path);
+    }
+    const auto dir  = std::string(path.substr(0, slash));
+    const auto name = path.substr(slash + 1);
+    auto       st   = Stat();
+    if(::stat(dir.empty() ? "/" : dir.data(), &st) == -1) {
+        return resolve_uncached(path);
+    }
+    {
+        auto [lock, path_cache] = critical_path_cache.access();
+        if(auto resolution = path_cache.find(dir, name, st.st_mtim)) {
+            stats.path_cache_hits += 1;
+            return std::move(resolution.value());
+        }
+    }
+    auto resolution = resolve_uncached(path);
+    {
+        auto [lock, path_cache] = critical_path_cache.access();
+        path_cache.insert(dir, name, st.st_mtim, resolution);
+    }
+    return resolution;
+}
+
+// called on changes made through the mount, which may happen within the mtime granularity
+auto forget_resolutions(const std::string_view path) -> void {
+    const auto slash = path.rfind('/');
+    if(slash == path.npos) {
+        return;
+    }
+    auto [lock, path_cache] = critical_path_cache.access();
+    path_cache.erase(path.substr(0, slash));
+}
+
+auto to_real_path(const std::string_view path) -> WeakString {
+    auto resolution = resolve(path);
+    if(resolution.real.empty()) {
         return path;
     }
-    return to_real_path<0>(path);
+    return std::move(resolution.real);
 }
 
-template <size_t N = 0>
 auto to_phantom_paths(const std::string_view path) -> std::vector<WeakString> {
-    if constexpr(N < std::tuple_size<Drivers>::value) {
-        auto& driver = std::get<N>(drivers);
-        auto  result = driver.get_phantom_paths(path);
-        if(result) {
-            auto r = std::vector<WeakString>();
-            r.reserve(result.value().size());
-            for(auto& s : result.value()) {
-                r.emplace_back(std::move(s));
-            }
-            return r;
-        }
-        return to_phantom_paths<N + 1>(path);
-    } else {
+    const auto index = source_extensions.find(extension_registry::get_extension(path));
+    if(!index) {
         return {path};
     }
+    auto result = visit_driver(*index, [path](const auto& driver) { return driver.get_phantom_paths(path); });
+    if(!result) {
+        return {path};
+    }
+    auto r = std::vector<WeakString>();
+    r.reserve(result.value().size());
+    for(auto& s : result.value()) {
+        r.emplace_back(std::move(s));
+    }
+    return r;
 }
 
-template <size_t N>
-auto open_phantom_file_by_driver(const char* const path, const int mode) -> std::optional<int> {
-    if constexpr(N < std::tuple_size<Drivers>::value) {
-        auto& driver = std::get<N>(drivers);
-        auto  result = driver.open_phantom_file(path);
-        if(result) {
-            return result.value();
-        }
-        return open_phantom_file_by_driver<N + 1>(path, mode);
-    } else {
+auto open_phantom_file_by_driver(const char* const path) -> std::optional<int> {
+    const auto index = find_phantom_driver(path);
+    if(!index) {
+        return std::nullopt;
+    }
+    return visit_driver(*index, [path](const auto& driver) { return driver.open_phantom_file(path); });
+}
+
+auto get_phantom_file_size_by_driver(const std::string_view path) -> std::optional<size_t> {
+    const auto index = find_phantom_driver(path);
+    if(!index) {
+        return std::nullopt;
+    }
+    return visit_driver(*index, [path](const auto& driver) { return driver.get_phantom_file_size(path); });
+}
+
+auto open_phantom_stream_by_driver(const std::string_view path) -> std::unique_ptr<PhantomStream> {
+    const auto index = find_phantom_driver(path);
+    if(!index) {
+        return nullptr;
+    }
+    return visit_driver(*index, [path](const auto& driver) { return driver.open_phantom_stream(path); });
+}
+
+// the real file a phantom file is generated from
+struct Source {
+    std::string    path;
+    SourceIdentity identity;
+    std::string    version; // of the driver, for the phantom file
+};
+
+// abs is the phantom file
+auto find_source(Resolution resolution, const std::string_view abs) -> std::optional<Source> {
+    if(!resolution.driver) {
+        return std::nullopt;
+    }
+    auto st = Stat();
+    if(::stat(resolution.real.data(), &st) == -1) {
         return std::nullopt;
     }
+    return Source{std::move(resolution.real), st, visit_driver(resolution.driver.value(), [abs](const auto& driver) { return driver.get_version(abs); })};
 }
 
-auto open_phantom_file(const std::string_view path, const char* const abs, const int mode) -> int {
-    if(std::filesystem::exists(abs)) {
-        return ::open(abs, mode);
+// drops everything generated from the real file at abs, including kernel caches
+auto invalidate_source(const std::string_view abs) -> void {
+    for(const auto& phantom : to_phantom_paths(abs)) {
+        if(phantom.view() == abs || !phantom.view().starts_with(root)) {
+            continue;
+        }
+        const auto path = phantom.view().substr(root.size());
+        decoded_cache.erase(path);
+        {
+            auto [lock, size_cache] = critical_size_cache.access();
+            size_cache.erase(path);
+        }
+        invalidator.push(std::string(path));
     }
+}
 
+auto cache_decoded_file(const std::string_view path, FileDescriptor fd, const Source& source) -> DecodeResult {
+    auto file = decoded_cache.insert(path, std::move(fd), source.identity);
+    if(!file) {
+        return {nullptr, errno};
+    }
     {
-        auto [lock, decoded_cache] = critical_decoded_cache.access();
-        if(const auto p = decoded_cache.find(path); p != decoded_cache.end()) {
-            return p->second.as_handle();
+        auto [lock, size_cache] = critical_size_cache.access();
+        size_cache.insert(path, file->size, source.identity);
+    }
+    if(watcher) {
+        watcher->watch(std::filesystem::path(source.path).parent_path().string());
+    }
+    return {std::move(file), 0};
+}
+
+auto decode_phantom_file(const std::string_view path, const char* const abs, const Source& source) -> DecodeResult {
+    const auto disk_cache_key = disk_cache ? std::optional(DiskCache::make_key(source.identity, source.version, abs)) : std::nullopt;
+    if(disk_cache_key) {
+        if(auto fd = disk_cache->open(*disk_cache_key)) {
+            stats.disk_cache_hits += 1;
+            return cache_decoded_file(path, std::move(fd), source);
         }
     }
 
-    const auto phantom_file = open_phantom_file_by_driver<0>(abs, mode);
+    const auto phantom_file = open_phantom_file_by_driver(abs);
     if(!phantom_file) {
-        return -1;
+        return {nullptr, ENOENT};
+    }
+    if(phantom_file.value() == -1) {
+        return {nullptr, EIO};
+    }
+
+    stats.decodes += 1;
+
+    auto result = cache_decoded_file(path, phantom_file.value(), source);
+    if(result.file && disk_cache_key && disk_cache->store(*disk_cache_key, result.file->fd.as_handle(), result.file->size)) {
+        stats.disk_cache_stores += 1;
+    }
+    return result;
+}
+
+// streams being read, so that concurrent opens of a file share one decode and one buffer
+struct LiveStream {
+    std::weak_ptr<PhantomStream> stream;
+    SourceIdentity               source;
+};
+
+auto critical_live_streams = Critical<StringMap<LiveStream>>();
+auto stream_store_pool     = ThreadPool(); // moves completed streams into the caches
+
+// wraps a stream of a driver, and moves its output into the caches once the last open of it is released
+class SharedStream : public PhantomStream {
+  private:
+    std::unique_ptr<PhantomStream> stream;
+    std::string                    path;
+    std::string                    abs;
+    Source                         source;
+
+  public:
+    auto get_size() const -> size_t override {
+        return stream->get_size();
+    }
+
+    auto read(std::byte* const buffer, const size_t size, const size_t offset) -> ssize_t override {
+        return stream->read(buffer, size, offset);
+    }
+
+    SharedStream(std::unique_ptr<PhantomStream> stream, const std::string_view path, const char* const abs, Source source)
+        : stream(std::move(stream)),
+          path(path),
+          abs(abs),
+          source(std::move(source)) {}
+
+    ~SharedStream() {
+        {
+            auto [lock, streams] = critical_live_streams.access();
+            if(const auto p = streams.find(path); p != streams.end() && p->second.stream.expired()) {
+                streams.erase(p);
+            }
+        }
+
+        auto fd = stream->take_file();
+        if(!fd) {
+            return;
+        }
+        // runs on whichever thread released the last open, which should not wait for the disk cache
+        stream_store_pool.push([path = std::move(path), abs = std::move(abs), source = std::move(source), fd = std::make_shared<FileDescriptor>(std::move(fd))]() {
+            stats.stream_stores += 1;
+            const auto result = cache_decoded_file(path, std::move(*fd), source);
+            if(result.file && disk_cache && disk_cache->store(DiskCache::make_key(source.identity, source.version, abs), result.file->fd.as_handle(), result.file->size)) {
+                stats.disk_cache_stores += 1;
+            }
+        });
     }
+};
 
-    const auto new_file = phantom_file.value();
+auto open_shared_stream(const std::string_view path, const char* const abs, const Source& source) -> std::shared_ptr<PhantomStream> {
+    const auto find_live = [path, &source](StringMap<LiveStream>& streams) -> std::shared_ptr<PhantomStream> {
+        const auto p = streams.find(path);
+        if(p == streams.end() || !(p->second.source == source.identity)) {
+            return nullptr;
+        }
+        return p->second.stream.lock();
+    };
 
     {
-        auto [lock, decoded_cache] = critical_decoded_cache.access();
-        decoded_cache.emplace(path, new_file);
+        auto [lock, streams] = critical_live_streams.access();
+        if(auto stream = find_live(streams)) {
+            stats.shared_streams += 1;
+            return stream;
+        }
+    }
+
+    // initializing reads the source, so it is done without the lock
+    auto stream = open_phantom_stream_by_driver(abs);
+    if(!stream) {
+        return nullptr;
+    }
+    if(!stream->is_shareable()) {
+        return stream;
     }
+    auto shared = std::shared_ptr<PhantomStream>(new SharedStream(std::move(stream), path, abs, source));
 
-    return new_file;
+    auto [lock, streams] = critical_live_streams.access();
+    if(auto live = find_live(streams)) {
+        // lost the race, ours is dropped after the lock is released, since it was declared earlier
+        stats.shared_streams += 1;
+        return live;
+    }
+    streams.insert_or_assign(std::string(path), LiveStream{shared, source.identity});
+    return shared;
 }
 
-auto close_phantom_file(const std::string_view path) -> bool {
-    auto [lock, decoded_cache] = critical_decoded_cache.access();
-    if(const auto p = decoded_cache.find(path); p != decoded_cache.end()) {
-        decoded_cache.erase(p);
-        return true;
+// streams are only used for actual opens
+auto open_phantom_file(const std::string_view path, const char* const abs, const int mode, const bool allow_stream = false) -> std::unique_ptr<Handle> {
+    auto resolution = resolve(abs);
+    if(!resolution.driver && !resolution.real.empty()) {
+        const auto fd = ::open(abs, mode);
+        if(fd == -1) {
+            return nullptr;
+        }
+        return std::unique_ptr<Handle>(new Handle(fd));
+    }
+
+    const auto source = find_source(std::move(resolution), abs);
+    if(!source) {
+        errno = ENOENT;
+        return nullptr;
+    }
+
+    if(allow_stream) {
+        if(auto file = decoded_cache.find(path, source->identity)) {
+            return std::unique_ptr<Handle>(new Handle(std::move(file), true));
+        }
+        if(auto stream = open_shared_stream(path, abs, *source)) {
+            return std::unique_ptr<Handle>(new Handle(std::move(stream)));
+        }
+    }
+
+    // concurrent opens of the same file share one decode
+    // a decode is inserted into the cache before leaving in_flight, so checking both under the in_flight lock always sees a finished one
+    auto promise = std::optional<std::promise<DecodeResult>>();
+    auto future  = std::shared_future<DecodeResult>();
+    {
+        auto [lock, in_flight] = critical_in_flight.access();
+        if(auto file = decoded_cache.find(path, source->identity)) {
+            return std::unique_ptr<Handle>(new Handle(std::move(file), true));
+        }
+        if(const auto p = in_flight.find(path); p != in_flight.end()) {
+            future = p->second;
+        } else {
+            promise.emplace();
+            in_flight.emplace(path, promise->get_future().share());
+        }
+    }
+
+    auto result = DecodeResult();
+    if(promise) {
+        // waiters and later opens must not see an abandoned entry, so failures are results too
+        try {
+            result = decode_phantom_file(path, abs, *source);
+        } catch(const std::bad_alloc&) {
+            result = {nullptr, ENOMEM};
+        } catch(...) {
+            result = {nullptr, EIO};
+        }
+        {
+            auto [lock, in_flight] = critical_in_flight.access();
+            in_flight.erase(in_flight.find(path));
+        }
+        promise->set_value(result);
     } else {
+        stats.coalesced_decodes += 1;
+        result = future.get();
+    }
+
+    if(!result.file) {
+        errno = result.error;
+        return nullptr;
+    }
+    return std::unique_ptr<Handle>(new Handle(std::move(result.file)));
+}
+
+auto close_phantom_file(std::unique_ptr<Handle> handle) -> void {
+    handle.reset();
+
+    // the released entry may be evictable now
+    decoded_cache.shrink();
+}
+
+// speculative decoding of the files following the last opened one
+// directories are remembered by readdir, so that "following" means the listing order
+struct Listing {
+    std::vector<std::string> paths;          // phantom files, relative to root
+    uint64_t                 generation = 0; // bumped to cancel queued prefetches
+};
+
+constexpr auto max_listings = size_t(64);
+
+auto critical_listings       = Critical<StringMap<Listing>>();
+auto critical_last_extension = Critical<std::string>(); // of the last opened phantom file
+auto prefetch_pool           = ThreadPool();
+
+auto prefetch_phantom_file(const std::string& dir, const std::string& path, const uint64_t generation) -> void {
+    {
+        auto [lock, listings] = critical_listings.access();
+        const auto p          = listings.find(dir);
+        if(p == listings.end() || p->second.generation != generation) {
+            return; // directory abandoned or prefetch rescheduled
+        }
+    }
+    // leave room for files actually opened
+    if(decoded_cache.get_total_size() >= decoded_cache.get_budget() / 4 * 3) {
+        return;
+    }
+
+    // prefetch workers are niced, but the decoding pool is not
+    drivers::jxl::ParallelRunner::set_background(true);
+
+    const auto abs    = root + path;
+    auto       handle = open_phantom_file(path, abs.data(), O_RDONLY);
+    if(!handle) {
+        return;
+    }
+    stats.prefetches += 1;
+    close_phantom_file(std::move(handle));
+}
+
+// queues files with the extension in dir, after the file named after
+// an empty after means the beginning of the listing
+// returns false if after is not a listed phantom file
+auto schedule_prefetch(const std::string_view dir, const std::string_view after, const std::string_view extension) -> bool {
+    auto [lock, listings] = critical_listings.access();
+    const auto p          = listings.find(dir);
+    if(p == listings.end()) {
         return false;
     }
+    auto& listing = p->second;
+
+    auto begin = listing.paths.begin();
+    if(!after.empty()) {
+        begin = std::find(listing.paths.begin(), listing.paths.end(), after);
+        if(begin == listing.paths.end()) {
+            return false;
+        }
+        begin = std::next(begin);
+    }
+
+    listing.generation += 1;
+    auto count = 0;
+    for(auto i = begin; i != listing.paths.end() && count < options.prefetch; i = std::next(i)) {
+        if(!i->ends_with(extension)) {
+            continue;
+        }
+        prefetch_pool.push([dir = std::string(dir), path = *i, generation = listing.generation]() {
+            prefetch_phantom_file(dir, path, generation);
+        });
+        count += 1;
+    }
+    return true;
+}
+
+auto record_listing(const std::string_view dir, std::vector<std::string> paths) -> void {
+    {
+        auto [lock, listings] = critical_listings.access();
+        if(listings.size() >= max_listings) {
+            listings.clear(); // also cancels their prefetches
+        }
+        auto& listing = listings[std::string(dir)];
+        listing.paths = std::move(paths);
+        listing.generation += 1;
+    }
+
+    auto extension = std::string();
+    {
+        auto [lock, last_extension] = critical_last_extension.access();
+        extension                   = last_extension;
+    }
+    if(!extension.empty()) {
+        schedule_prefetch(dir, {}, extension);
+    }
+}
+
+auto on_phantom_file_opened(const std::string_view path) -> void {
+    const auto extension = std::filesystem::path(path).extension().string();
+    if(!schedule_prefetch(std::filesystem::path(path).parent_path().string(), path, extension)) {
+        return;
+    }
+    auto [lock, last_extension] = critical_last_extension.access();
+    last_extension              = extension;
 }
 
-auto is_cached_phantom_file(const std::string_view path) -> bool {
-    auto [lock, decoded_cache] = critical_decoded_cache.access();
-    return decoded_cache.find(path) != decoded_cache.end();
+// prefers methods which do not require decoding
+auto get_phantom_file_size(const std::string_view path, const char* const abs, Resolution resolution) -> std::optional<size_t> {
+    if(const auto size = get_phantom_file_size_by_driver(abs)) {
+        return size;
+    }
+
+    const auto source = find_source(std::move(resolution), abs);
+    if(!source) {
+        errno = ENOENT;
+        return std::nullopt;
+    }
+    {
+        auto [lock, size_cache] = critical_size_cache.access();
+        if(const auto size = size_cache.find(path, source->identity)) {
+            return size;
+        }
+    }
+
+    auto file = open_phantom_file(path, abs, O_RDONLY);
+    if(!file) {
+        return std::nullopt;
+    }
+    const auto size = file->get_size();
+    close_phantom_file(std::move(file));
+    return size;
 }
 
 class FileHandle {
   private:
-    int  fd;
-    bool opened;
+    std::unique_ptr<Handle> opened;
+    Handle*                 handle;
 
   public:
     operator int() const {
-        return fd;
+        return handle != nullptr ? handle->get_fd() : -1;
+    }
+
+    auto get() const -> Handle* {
+        return handle;
     }
 
     FileHandle(const std::string_view path, const char* const abs, const int mode, fuse_file_info* const fi) {
         if(fi != NULL) {
-            fd     = fi->fh;
-            opened = false;
+            handle = &to_handle(fi);
         } else {
-            fd     = open_phantom_file(path, abs, mode);
-            opened = true;
+            opened = open_phantom_file(path, abs, mode);
+            handle = opened.get();
         }
     }
 
     ~FileHandle() {
         if(opened) {
-            ::close(fd);
+            close_phantom_file(std::move(opened));
         }
     }
 };
 
-auto init(fuse_conn_info* const /*conn*/, fuse_config* const cfg) -> void* {
-    cfg->entry_timeout    = 0;
-    cfg->entry_timeout    = 0;
-    cfg->attr_timeout     = 0;
-    cfg->negative_timeout = 0;
+// shared by both backends
+// must be called from init, since fuse forks before that
+auto start_workers(KernelInvalidator::Invalidate invalidate) -> void {
+    invalidator.start(std::move(invalidate));
+    if(options.prefetch > 0) {
+        prefetch_pool.start(std::max(options.prefetch_threads, 1), 19);
+    }
+    if(options.streaming) {
+        stream_store_pool.start(1);
+    }
+    if(options.watch) {
+        watcher.emplace();
+        if(!watcher->start(invalidate_source)) {
+            std::cerr << "failed to start watcher" << std::endl;
+            watcher.reset();
+        }
+    }
+}
+
+auto init(fuse_conn_info* const conn, fuse_config* const cfg) -> void* {
+    cfg->entry_timeout    = options.entry_timeout;
+    cfg->attr_timeout     = options.attr_timeout;
+    cfg->negative_timeout = options.negative_timeout;
+
+    // read replies are spliced from memfds and real files
+    conn->want |= conn->capable & (FUSE_CAP_SPLICE_WRITE | FUSE_CAP_SPLICE_MOVE);
+
+    start_workers([instance = fuse_get_context()->fuse](const std::string& path) {
+        // fails with ENOENT if the kernel does not know the path, which is fine
+        fuse_invalidate_path(instance, path.data());
+    });
     return NULL;
 }
 
-auto getattr(const char* const path, Stat* const stbuf, fuse_file_info* /*fi*/) -> int {
-    const auto abs      = root + path;
-    const auto new_path = to_real_path(abs);
-    const auto res      = ::lstat(new_path.cstr(), stbuf);
+auto destroy(void* const /*private_data*/) -> void {
+    if(watcher) {
+        watcher->stop();
+    }
+    prefetch_pool.stop();
+    stream_store_pool.stop();
+    invalidator.stop();
+    print_stats(std::cerr);
+}
 
-    if(new_path.view() != abs) {
+// shared with the low-level backend, which uses it for phantom files
+auto stat_by_path(const char* const path, Stat* const stbuf) -> int {
+    const auto abs        = root + path;
+    auto       resolution = resolve(abs);
+    const auto res        = ::lstat(resolution.real.empty() ? abs.data() : resolution.real.data(), stbuf);
+    if(res == -1) {
+        return -errno;
+    }
+
+    if(resolution.driver) {
         // this is phantom file
         // we have to set proper file size
-        const auto file = open_phantom_file(path, abs.data(), 0);
-        const auto size = get_fd_size(file);
-        if(size != -1) {
-            stbuf->st_size = size;
-        } else {
+        const auto size = get_phantom_file_size(path, abs.data(), std::move(resolution));
+        if(!size) {
             return -errno;
         }
+        stbuf->st_size = size.value();
 
         // mark symlink as regular file
         if(stbuf->st_mode & S_IFLNK) {
@@ -204,7 +776,11 @@ auto getattr(const char* const path, Stat* const stbuf, fuse_file_info* /*fi*/)
         }
     }
 
-    return res == -1 ? -errno : 0;
+    return 0;
+}
+
+auto getattr(const char* const path, Stat* const stbuf, fuse_file_info* /*fi*/) -> int {
+    return stat_by_path(path, stbuf);
 }
 
 auto access(const char* const path, const int mask) -> int {
@@ -243,20 +819,29 @@ auto readdir(const char* const path, void* const buf, const fuse_fill_dir_t fill
         return -errno;
     }
 
-    auto de = (dirent*)(nullptr);
+    auto phantoms = std::vector<std::string>();
+    auto de       = (dirent*)(nullptr);
     while((de = ::readdir(dir)) != NULL) {
         auto st = Stat();
         memset(&st, 0, sizeof(st));
         st.st_ino  = de->d_ino;
         st.st_mode = de->d_type << 12;
 
-        for(const auto& file : to_phantom_paths(abs + "/" + de->d_name)) {
+        // abs of the root ends with "/" already, and prefetch compares paths as strings
+        const auto real = abs + (std::string_view(path) == "/" ? "" : "/") + de->d_name;
+        for(const auto& file : to_phantom_paths(real)) {
             const auto new_filename = std::filesystem::path(file.view()).filename().string();
             if(filler(buf, new_filename.data(), &st, 0, FUSE_FILL_DIR_PLUS)) {
                 goto finish;
             }
+            if(options.prefetch > 0 && file.view() != real) {
+                phantoms.emplace_back(file.view().substr(root.size()));
+            }
         }
     }
+    if(options.prefetch > 0) {
+        record_listing(path, std::move(phantoms));
+    }
 finish:
     closedir(dir);
     return 0;
@@ -265,26 +850,43 @@ finish:
 auto mkdir(const char* const path, const mode_t mode) -> int {
     const auto abs = root + path;
     const auto res = ::mkdir(abs.data(), mode);
-    return res == -1 ? -errno : 0;
+    if(res == -1) {
+        return -errno;
+    }
+    forget_resolutions(abs);
+    return 0;
 }
 
 auto unlink(const char* const path) -> int {
     const auto abs = root + path;
     const auto res = ::unlink(abs.data());
-    return res == -1 ? -errno : 0;
+    if(res == -1) {
+        return -errno;
+    }
+    forget_resolutions(abs);
+    invalidate_source(abs);
+    return 0;
 }
 
 auto rmdir(const char* const path) -> int {
     const auto abs = root + path;
     const auto res = ::rmdir(abs.data());
-    return res == -1 ? -errno : 0;
+    if(res == -1) {
+        return -errno;
+    }
+    forget_resolutions(abs);
+    return 0;
 }
 
 auto symlink(const char* const from, const char* const to) -> int {
     const auto abs_from = root + from;
     const auto abs_to   = root + to;
     const auto res      = ::symlink(abs_from.data(), abs_to.data());
-    return res == -1 ? -errno : 0;
+    if(res == -1) {
+        return -errno;
+    }
+    forget_resolutions(abs_to);
+    return 0;
 }
 
 auto rename(const char* const from, const char* const to, const unsigned int flag) -> int {
@@ -295,15 +897,26 @@ auto rename(const char* const from, const char* const to, const unsigned int fla
     const auto abs_from = root + from;
     const auto abs_to   = root + to;
     const auto res      = ::rename(abs_from.data(), abs_to.data());
-    return res == -1 ? -errno : 0;
+    if(res == -1) {
+        return -errno;
+    }
+    forget_resolutions(abs_from);
+    forget_resolutions(abs_to);
+    invalidate_source(abs_from);
+    invalidate_source(abs_to);
+    return 0;
 }
 
 auto link(const char* const from, const char* const to) -> int {
     const auto abs_from = root + from;
     const auto abs_to   = root + to;
     const auto res      = ::link(abs_from.data(), abs_to.data());
-    return res == -1 ? -errno : 0;
-}
+    if(res == -1) {
+        return -errno;
+    }
+    forget_resolutions(abs_to);
+    return 0;
+}
 
 auto chmod(const char* const path, const mode_t mode, fuse_file_info* const /*fi*/) -> int {
     const auto abs      = root + path;
@@ -322,15 +935,24 @@ auto chown(const char* const path, const uid_t uid, const gid_t gid, fuse_file_i
 auto truncate(const char* const path, const off_t size, fuse_file_info* const fi) -> int {
     const auto abs      = root + path;
     const auto new_path = to_real_path(abs);
-    const auto res      = fi != NULL ? ::ftruncate(fi->fh, size) : ::truncate(new_path.cstr(), size);
-    return res == -1 ? -errno : 0;
+    const auto res      = fi != NULL ? ::ftruncate(to_handle(fi).get_fd(), size) : ::truncate(new_path.cstr(), size);
+    if(res == -1) {
+        return -errno;
+    }
+    invalidate_source(new_path.view());
+    return 0;
 }
 
 auto create(const char* path, const mode_t mode, fuse_file_info* const fi) -> int {
     const auto abs = root + path;
     const auto res = ::open(abs.data(), fi->flags, mode);
-    fi->fh         = res;
-    return 0;
+    if(res == -1) {
+        return -errno;
+    }
+    forget_resolutions(abs);
+    invalidate_source(abs);
+    fi->fh = to_fh(std::unique_ptr<Handle>(new Handle(res)));
+    return fi->fh != 0 ? 0 : -ENFILE;
 }
 
 auto utimens(const char* const path, const timespec tv[2], fuse_file_info* const fi) -> int {
@@ -340,25 +962,103 @@ auto utimens(const char* const path, const timespec tv[2], fuse_file_info* const
     return res == -1 ? -errno : 0;
 }
 
-auto open(const char* const path, fuse_file_info* const fi) -> int {
+// shared with the low-level backend, which uses it for phantom files
+auto open_by_path(const char* const path, fuse_file_info* const fi) -> int {
     const auto abs = root + path;
-    const auto res = open_phantom_file(path, abs.data(), fi->flags);
-    fi->fh         = res;
+    auto       res = open_phantom_file(path, abs.data(), fi->flags, options.streaming);
+    if(!res) {
+        return -errno;
+    }
+    fi->keep_cache = res->is_reused();
+    fi->fh         = to_fh(std::move(res));
+    if(fi->fh == 0) {
+        return -ENFILE;
+    }
+    if(options.prefetch > 0) {
+        on_phantom_file_opened(path);
+    }
     return 0;
 }
 
+auto open(const char* const path, fuse_file_info* const fi) -> int {
+    return open_by_path(path, fi);
+}
+
 auto read(const char* const path, char* const buf, const size_t size, const off_t offset, fuse_file_info* const fi) -> int {
     const auto abs  = root + path;
     const auto file = FileHandle(path, abs.data(), O_RDONLY, fi);
-    auto       res  = ::pread(file, buf, size, offset);
+    if(file.get() == nullptr) {
+        return -errno;
+    }
+    file.get()->on_read(offset, size);
+    const auto res = file.get()->read(buf, size, offset);
     return res == -1 ? -errno : res;
 }
 
+// bytes a read of size at offset returns, for counting reads which are not done by us
+auto get_readable_size(const Handle& handle, const size_t size, const off_t offset) -> size_t {
+    return size_t(std::clamp(handle.get_size() - offset, ssize_t(0), ssize_t(size)));
+}
+
+// lets libfuse splice straight from the file, instead of copying it through buf
+// libfuse frees the returned bufvec, and its memory if not backed by fd
+auto read_buf(const char* const path, fuse_bufvec** const bufp, const size_t size, const off_t offset, fuse_file_info* const fi) -> int {
+    const auto abs  = root + path;
+    const auto file = FileHandle(path, abs.data(), O_RDONLY, fi);
+    if(file.get() == nullptr) {
+        return -errno;
+    }
+    file.get()->on_read(offset, size);
+
+    const auto src = (fuse_bufvec*)malloc(sizeof(fuse_bufvec));
+    if(src == NULL) {
+        return -ENOMEM;
+    }
+    // same as FUSE_BUFVEC_INIT(), which is a compound literal
+    *src = fuse_bufvec{.count = 1, .idx = 0, .off = 0, .buf = {fuse_buf{.size = size, .flags = fuse_buf_flags(0), .mem = NULL, .fd = -1, .pos = 0}}};
+
+    // a temporarily opened file is closed before libfuse reads the fd
+    if(fi != NULL && file.get()->get_fd() != -1) {
+        src->buf[0].flags = fuse_buf_flags(FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK);
+        src->buf[0].fd    = file.get()->get_fd();
+        src->buf[0].pos   = offset;
+        stats.zero_copy_reads += 1;
+        stats.read_bytes += get_readable_size(*file.get(), size, offset);
+        *bufp = src;
+        return 0;
+    }
+
+    const auto mem = malloc(size);
+    if(mem == NULL) {
+        free(src);
+        return -ENOMEM;
+    }
+    const auto res = file.get()->read(std::bit_cast<char*>(mem), size, offset);
+    if(res == -1) {
+        const auto error = errno;
+        free(mem);
+        free(src);
+        return -error;
+    }
+    src->buf[0].mem  = mem;
+    src->buf[0].size = res;
+    stats.copied_reads += 1;
+    stats.read_bytes += res;
+    *bufp = src;
+    return 0;
+}
+
 auto write(const char* const path, const char* const buf, const size_t size, const off_t offset, fuse_file_info* const fi) -> int {
     const auto abs  = root + path;
     const auto file = FileHandle(path, abs.data(), O_WRONLY, fi);
     auto       res  = ::pwrite(file, buf, size, offset);
-    return res == -1 ? -errno : res;
+    if(res == -1) {
+        return -errno;
+    }
+    if(file.get()->mark_written()) {
+        invalidate_source(abs);
+    }
+    return res;
 }
 
 auto statfs(const char* const path, Statvfs* const stbuf) -> int {
@@ -369,18 +1069,12 @@ auto statfs(const char* const path, Statvfs* const stbuf) -> int {
 }
 
 auto release(const char* const path, fuse_file_info* const fi) -> int {
-    constexpr auto do_not_delete_cache = true;
-
-    if(do_not_delete_cache) {
-        if(!is_cached_phantom_file(path)) {
-            ::close(fi->fh);
-        }
-    } else {
-        if(!close_phantom_file(path)) {
-            ::close(fi->fh);
-        }
+    auto& handle = to_handle(fi);
+    if(handle.is_written()) {
+        // phantom files may have been regenerated while writing
+        invalidate_source(root + path);
     }
-
+    close_phantom_file(release_fh(fi));
     return 0;
 }
 
@@ -479,7 +1173,7 @@ const auto operations = fuse_operations{
     .releasedir      = NULL,
     .fsyncdir        = NULL,
     .init            = init,
-    .destroy         = NULL,
+    .destroy         = destroy,
     .access          = access,
     .create          = create,
     .lock            = NULL,
@@ -488,23 +1182,832 @@ const auto operations = fuse_operations{
     .ioctl           = NULL,
     .poll            = NULL,
     .write_buf       = NULL,
-    .read_buf        = NULL,
+    .read_buf        = read_buf,
     .flock           = NULL,
     .fallocate       = fallocate,
     .copy_file_range = copy_file_range,
     .lseek           = lseek,
 };
+
+// low-level backend, selected with -o lowlevel
+// requests name inodes instead of paths, and real files are accessed relative to the descriptor of their directory
+// phantom files go through the path based functions above, since every cache is keyed by path
+namespace lowlevel {
+auto critical_inodes = Critical<InodeTable>();
+auto session         = (fuse_session*)(nullptr);
+
+struct DirEntry {
+    std::string name;
+    ino_t       ino;
+    mode_t      type;
+};
+
+using DirListing = std::vector<DirEntry>;
+
+auto locate(const fuse_ino_t ino) -> std::optional<InodeTable::Location> {
+    auto [lock, inodes] = critical_inodes.access();
+    return inodes.get_location(ino);
+}
+
+auto get_dir_fd(const fuse_ino_t ino) -> InodeTable::DirFd {
+    auto [lock, inodes] = critical_inodes.access();
+    return inodes.get_dir_fd(ino);
+}
+
+// path of name in parent, as the high-level backend sees it
+auto make_path(const fuse_ino_t parent, const std::string_view name) -> std::optional<std::string> {
+    auto path = std::optional<std::string>();
+    {
+        auto [lock, inodes] = critical_inodes.access();
+        path                = inodes.get_path(parent);
+    }
+    if(!path) {
+        return std::nullopt;
+    }
+    if(path->back() != '/') {
+        *path += "/";
+    }
+    *path += name;
+    return path;
+}
+
+auto get_path(const InodeTable::Location& location) -> std::optional<std::string> {
+    if(location.parent == 0) {
+        return "/";
+    }
+    return make_path(location.parent, location.name);
+}
+
+// phantom files are the names which do not exist but have a phantom extension
+auto is_phantom(const int dir, const char* const name) -> bool {
+    auto st = Stat();
+    return fstatat(dir, name, &st, AT_SYMLINK_NOFOLLOW) == -1 && errno == ENOENT && find_phantom_driver(name);
+}
+
+// the entry itself, or the source of a phantom file
+auto get_real_name(const InodeTable::Location& location) -> std::string {
+    if(!is_phantom(location.dir->as_handle(), location.name.data())) {
+        return location.name;
+    }
+    const auto index     = find_phantom_driver(location.name).value();
+    const auto extension = visit_driver(index, [](const auto& driver) { return std::string_view(std::remove_cvref_t<decltype(driver)>::source_extension); });
+    return std::filesystem::path(location.name).replace_extension(extension).string();
+}
+
+// returns errno
+auto stat_entry(const InodeTable::Location& location, Stat& st) -> int {
+    if(fstatat(location.dir->as_handle(), location.name.data(), &st, AT_SYMLINK_NOFOLLOW) == 0) {
+        return 0;
+    }
+    if(errno != ENOENT || !find_phantom_driver(location.name)) {
+        return errno;
+    }
+    const auto path = get_path(location);
+    if(!path) {
+        return ENOENT;
+    }
+    return -stat_by_path(path->data(), &st);
+}
+
+// stats name in parent and adds it to the inode table
+auto reply_entry(const fuse_req_t req, const fuse_ino_t parent, const char* const name) -> void {
+    const auto dir = get_dir_fd(parent);
+    if(!dir) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+    auto entry = fuse_entry_param();
+    if(const auto error = stat_entry({parent, dir, name}, entry.attr); error != 0) {
+        if(error == ENOENT) {
+            // removed outside of the mount, inodes of the old entry must not resolve to anything else
+            auto [lock, inodes] = critical_inodes.access();
+            inodes.unlink(parent, name);
+        }
+        if(error == ENOENT && options.negative_timeout > 0) {
+            // an entry without inode is cached as a negative lookup
+            entry.entry_timeout = options.negative_timeout;
+            fuse_reply_entry(req, &entry);
+        } else {
+            fuse_reply_err(req, error);
+        }
+        return;
+    }
+    {
+        auto [lock, inodes] = critical_inodes.access();
+        entry.ino           = inodes.lookup(parent, name, entry.attr);
+    }
+    if(entry.ino == 0) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+    entry.attr_timeout  = options.attr_timeout;
+    entry.entry_timeout = options.entry_timeout;
+    if(fuse_reply_entry(req, &entry) != 0) {
+        // the kernel did not get the reference
+        auto [lock, inodes] = critical_inodes.access();
+        inodes.forget(entry.ino, 1);
+    }
+}
+
+// forgets cached resolutions of name in parent, and phantom files generated from it if invalidate is set
+auto on_entry_changed(const fuse_ino_t parent, const std::string_view name, const bool invalidate) -> void {
+    const auto path = make_path(parent, name);
+    if(!path) {
+        return;
+    }
+    const auto abs = root + *path;
+    forget_resolutions(abs);
+    if(invalidate) {
+        invalidate_source(abs);
+    }
+}
+
+auto init(void* const /*userdata*/, fuse_conn_info* const conn) -> void {
+    // read replies are spliced from memfds and real files
+    conn->want |= conn->capable & (FUSE_CAP_SPLICE_WRITE | FUSE_CAP_SPLICE_MOVE);
+
+    start_workers([](const std::string& path) {
+        auto found = std::optional<std::pair<fuse_ino_t, fuse_ino_t>>();
+        {
+            auto [lock, inodes] = critical_inodes.access();
+            found               = inodes.find_path(path);
+        }
+        if(!found) {
+            return; // the kernel does not know the path
+        }
+        const auto name = std::string_view(path).substr(path.rfind('/') + 1);
+        fuse_lowlevel_notify_inval_inode(session, found->second, 0, 0);
+        fuse_lowlevel_notify_inval_entry(session, found->first, name.data(), name.size());
+    });
+}
+
+auto lookup(const fuse_req_t req, const fuse_ino_t parent, const char* const name) -> void {
+    reply_entry(req, parent, name);
+}
+
+auto forget(const fuse_req_t req, const fuse_ino_t ino, const uint64_t nlookup) -> void {
+    {
+        auto [lock, inodes] = critical_inodes.access();
+        inodes.forget(ino, nlookup);
+    }
+    fuse_reply_none(req);
+}
+
+auto forget_multi(const fuse_req_t req, const size_t count, fuse_forget_data* const forgets) -> void {
+    {
+        auto [lock, inodes] = critical_inodes.access();
+        for(auto i = size_t(0); i < count; i += 1) {
+            inodes.forget(forgets[i].ino, forgets[i].nlookup);
+        }
+    }
+    fuse_reply_none(req);
+}
+
+// an open file stays accessible after its entry is gone, like an unlinked file does
+// returns errno
+auto stat_handle(const fuse_ino_t ino, const Handle& handle, Stat& st) -> int {
+    if(!handle.is_phantom()) {
+        return ::fstat(handle.get_fd(), &st) == -1 ? errno : 0;
+    }
+    const auto location = locate(ino);
+    if(!location || stat_entry(*location, st) != 0) {
+        st         = Stat();
+        st.st_mode = S_IFREG | 0444;
+        st.st_uid  = getuid();
+        st.st_gid  = getgid();
+    }
+    st.st_ino   = ino;
+    st.st_nlink = std::max(st.st_nlink, nlink_t(1));
+    st.st_size  = handle.get_size();
+    return 0;
+}
+
+auto getattr(const fuse_req_t req, const fuse_ino_t ino, fuse_file_info* const fi) -> void {
+    auto st = Stat();
+    if(fi != NULL) {
+        if(const auto error = stat_handle(ino, to_handle(fi), st); error != 0) {
+            fuse_reply_err(req, error);
+            return;
+        }
+        fuse_reply_attr(req, &st, options.attr_timeout);
+        return;
+    }
+    const auto location = locate(ino);
+    if(!location) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+    if(const auto error = stat_entry(*location, st); error != 0) {
+        fuse_reply_err(req, error);
+        return;
+    }
+    fuse_reply_attr(req, &st, options.attr_timeout);
+}
+
+// changes of phantom files are applied to their sources, as the high-level backend does
+// real files which are open are changed through their fd, so that it works after they are unlinked
+auto setattr(const fuse_req_t req, const fuse_ino_t ino, Stat* const attr, const int to_set, fuse_file_info* const fi) -> void {
+    const auto fd       = fi != NULL && !to_handle(fi).is_phantom() ? to_handle(fi).get_fd() : -1;
+    const auto location = locate(ino);
+    if(fd == -1 && !location) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+    const auto dir  = location ? location->dir->as_handle() : -1;
+    const auto name = location ? get_real_name(*location) : std::string();
+
+    if(to_set & FUSE_SET_ATTR_MODE) {
+        if((fd != -1 ? fchmod(fd, attr->st_mode) : fchmodat(dir, name.data(), attr->st_mode, 0)) == -1) {
+            fuse_reply_err(req, errno);
+            return;
+        }
+    }
+    if(to_set & (FUSE_SET_ATTR_UID | FUSE_SET_ATTR_GID)) {
+        const auto uid = (to_set & FUSE_SET_ATTR_UID) ? attr->st_uid : uid_t(-1);
+        const auto gid = (to_set & FUSE_SET_ATTR_GID) ? attr->st_gid : gid_t(-1);
+        if((fd != -1 ? fchown(fd, uid, gid) : fchownat(dir, name.data(), uid, gid, AT_SYMLINK_NOFOLLOW)) == -1) {
+            fuse_reply_err(req, errno);
+            return;
+        }
+    }
+    if(to_set & FUSE_SET_ATTR_SIZE) {
+        auto res = 0;
+        if(fd != -1) {
+            res = ::ftruncate(fd, attr->st_size);
+        } else {
+            const auto fd = FileDescriptor(openat(dir, name.data(), O_WRONLY | O_CLOEXEC));
+            res           = fd ? ::ftruncate(fd.as_handle(), attr->st_size) : -1;
+        }
+        if(res == -1) {
+            fuse_reply_err(req, errno);
+            return;
+        }
+        if(location && location->parent != 0) {
+            on_entry_changed(location->parent, name, true);
+        }
+    }
+    if(to_set & (FUSE_SET_ATTR_ATIME | FUSE_SET_ATTR_MTIME)) {
+        const auto get_time = [&to_set](const int set, const int now, const timespec& time) -> timespec {
+            if(to_set & now) {
+                return {0, UTIME_NOW};
+            }
+            if(to_set & set) {
+                return time;
+            }
+            return {0, UTIME_OMIT};
+        };
+        const timespec times[2] = {
+            get_time(FUSE_SET_ATTR_ATIME, FUSE_SET_ATTR_ATIME_NOW, attr->st_atim),
+            get_time(FUSE_SET_ATTR_MTIME, FUSE_SET_ATTR_MTIME_NOW, attr->st_mtim),
+        };
+        if((fd != -1 ? futimens(fd, times) : utimensat(dir, name.data(), times, AT_SYMLINK_NOFOLLOW)) == -1) {
+            fuse_reply_err(req, errno);
+            return;
+        }
+    }
+    getattr(req, ino, fi);
+}
+
+auto readlink(const fuse_req_t req, const fuse_ino_t ino) -> void {
+    const auto location = locate(ino);
+    if(!location) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+    if(is_phantom(location->dir->as_handle(), location->name.data())) {
+        // phantom files are regular files
+        fuse_reply_readlink(req, location->name.data());
+        return;
+    }
+    auto       buf = std::array<char, PATH_MAX>();
+    const auto res = readlinkat(location->dir->as_handle(), location->name.data(), buf.data(), buf.size() - 1);
+    if(res == -1) {
+        fuse_reply_err(req, errno);
+        return;
+    }
+    buf[res] = '\0';
+    fuse_reply_readlink(req, buf.data());
+}
+
+auto mkdir(const fuse_req_t req, const fuse_ino_t parent, const char* const name, const mode_t mode) -> void {
+    const auto dir = get_dir_fd(parent);
+    if(!dir) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+    if(mkdirat(dir->as_handle(), name, mode) == -1) {
+        fuse_reply_err(req, errno);
+        return;
+    }
+    on_entry_changed(parent, name, false);
+    reply_entry(req, parent, name);
+}
+
+// device nodes, fifos and sockets, also plain files if the kernel does not use create
+auto mknod(const fuse_req_t req, const fuse_ino_t parent, const char* const name, const mode_t mode, const dev_t rdev) -> void {
+    const auto dir = get_dir_fd(parent);
+    if(!dir) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+    if(mknodat(dir->as_handle(), name, mode, rdev) == -1) {
+        fuse_reply_err(req, errno);
+        return;
+    }
+    on_entry_changed(parent, name, true);
+    reply_entry(req, parent, name);
+}
+
+auto remove(const fuse_req_t req, const fuse_ino_t parent, const char* const name, const int flags) -> void {
+    const auto dir = get_dir_fd(parent);
+    if(!dir) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+    if(unlinkat(dir->as_handle(), name, flags) == -1) {
+        fuse_reply_err(req, errno);
+        return;
+    }
+    {
+        auto [lock, inodes] = critical_inodes.access();
+        inodes.unlink(parent, name);
+    }
+    on_entry_changed(parent, name, flags == 0);
+    fuse_reply_err(req, 0);
+}
+
+auto unlink(const fuse_req_t req, const fuse_ino_t parent, const char* const name) -> void {
+    remove(req, parent, name, 0);
+}
+
+auto rmdir(const fuse_req_t req, const fuse_ino_t parent, const char* const name) -> void {
+    remove(req, parent, name, AT_REMOVEDIR);
+}
+
+auto symlink(const fuse_req_t req, const char* const link, const fuse_ino_t parent, const char* const name) -> void {
+    const auto dir = get_dir_fd(parent);
+    if(!dir) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+    // same target as the high-level backend
+    const auto target = root + link;
+    if(symlinkat(target.data(), dir->as_handle(), name) == -1) {
+        fuse_reply_err(req, errno);
+        return;
+    }
+    on_entry_changed(parent, name, false);
+    reply_entry(req, parent, name);
+}
+
+auto rename(const fuse_req_t req, const fuse_ino_t parent, const char* const name, const fuse_ino_t new_parent, const char* const new_name, const unsigned int flags) -> void {
+    if(flags) {
+        fuse_reply_err(req, EINVAL);
+        return;
+    }
+    const auto dir     = get_dir_fd(parent);
+    const auto new_dir = get_dir_fd(new_parent);
+    if(!dir || !new_dir) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+    if(renameat(dir->as_handle(), name, new_dir->as_handle(), new_name) == -1) {
+        fuse_reply_err(req, errno);
+        return;
+    }
+    {
+        auto [lock, inodes] = critical_inodes.access();
+        inodes.rename(parent, name, new_parent, new_name);
+    }
+    on_entry_changed(parent, name, true);
+    on_entry_changed(new_parent, new_name, true);
+    fuse_reply_err(req, 0);
+}
+
+auto link(const fuse_req_t req, const fuse_ino_t ino, const fuse_ino_t new_parent, const char* const new_name) -> void {
+    const auto location = locate(ino);
+    const auto new_dir  = get_dir_fd(new_parent);
+    if(!location || !new_dir) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+    if(linkat(location->dir->as_handle(), location->name.data(), new_dir->as_handle(), new_name, 0) == -1) {
+        fuse_reply_err(req, errno);
+        return;
+    }
+    on_entry_changed(new_parent, new_name, false);
+    reply_entry(req, new_parent, new_name);
+}
+
+auto open(const fuse_req_t req, const fuse_ino_t ino, fuse_file_info* const fi) -> void {
+    const auto location = locate(ino);
+    if(!location) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+    if(is_phantom(location->dir->as_handle(), location->name.data())) {
+        const auto path = get_path(*location);
+        if(!path) {
+            fuse_reply_err(req, ENOENT);
+            return;
+        }
+        if(const auto res = open_by_path(path->data(), fi); res != 0) {
+            fuse_reply_err(req, -res);
+            return;
+        }
+    } else {
+        const auto fd = openat(location->dir->as_handle(), location->name.data(), fi->flags);
+        if(fd == -1) {
+            fuse_reply_err(req, errno);
+            return;
+        }
+        fi->fh = to_fh(std::unique_ptr<Handle>(new Handle(fd)));
+        if(fi->fh == 0) {
+            fuse_reply_err(req, ENFILE);
+            return;
+        }
+    }
+    if(fuse_reply_open(req, fi) != 0) {
+        close_phantom_file(release_fh(fi));
+    }
+}
+
+auto create(const fuse_req_t req, const fuse_ino_t parent, const char* const name, const mode_t mode, fuse_file_info* const fi) -> void {
+    const auto dir = get_dir_fd(parent);
+    if(!dir) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+    const auto fd = openat(dir->as_handle(), name, fi->flags | O_CREAT, mode);
+    if(fd == -1) {
+        fuse_reply_err(req, errno);
+        return;
+    }
+    on_entry_changed(parent, name, true);
+
+    auto entry = fuse_entry_param();
+    if(::fstat(fd, &entry.attr) == -1) {
+        const auto error = errno;
+        ::close(fd);
+        fuse_reply_err(req, error);
+        return;
+    }
+    {
+        auto [lock, inodes] = critical_inodes.access();
+        entry.ino           = inodes.lookup(parent, name, entry.attr);
+    }
+    entry.attr_timeout  = options.attr_timeout;
+    entry.entry_timeout = options.entry_timeout;
+    fi->fh              = to_fh(std::unique_ptr<Handle>(new Handle(fd)));
+    if(fi->fh == 0) {
+        auto [lock, inodes] = critical_inodes.access();
+        inodes.forget(entry.ino, 1);
+        fuse_reply_err(req, ENFILE);
+        return;
+    }
+    if(fuse_reply_create(req, &entry, fi) != 0) {
+        close_phantom_file(release_fh(fi));
+        auto [lock, inodes] = critical_inodes.access();
+        inodes.forget(entry.ino, 1);
+    }
+}
+
+// spliced from the fd if there is one, like read_buf of the high-level backend
+auto read(const fuse_req_t req, const fuse_ino_t /*ino*/, const size_t size, const off_t offset, fuse_file_info* const fi) -> void {
+    auto& handle = to_handle(fi);
+    handle.on_read(offset, size);
+    if(handle.get_fd() != -1) {
+        auto buf = fuse_bufvec{.count = 1, .idx = 0, .off = 0, .buf = {fuse_buf{.size = size, .flags = fuse_buf_flags(FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK), .mem = NULL, .fd = handle.get_fd(), .pos = offset}}};
+        stats.zero_copy_reads += 1;
+        stats.read_bytes += get_readable_size(handle, size, offset);
+        fuse_reply_data(req, &buf, FUSE_BUF_SPLICE_MOVE);
+        return;
+    }
+
+    auto       buf = std::vector<char>(size);
+    const auto res = handle.read(buf.data(), size, offset);
+    if(res == -1) {
+        fuse_reply_err(req, errno);
+        return;
+    }
+    stats.copied_reads += 1;
+    stats.read_bytes += res;
+    fuse_reply_buf(req, buf.data(), res);
+}
+
+auto write(const fuse_req_t req, const fuse_ino_t ino, const char* const buf, const size_t size, const off_t offset, fuse_file_info* const fi) -> void {
+    auto&      handle = to_handle(fi);
+    const auto res    = ::pwrite(handle.get_fd(), buf, size, offset);
+    if(res == -1) {
+        fuse_reply_err(req, errno);
+        return;
+    }
+    if(handle.mark_written()) {
+        if(const auto location = locate(ino); location && location->parent != 0) {
+            on_entry_changed(location->parent, location->name, true);
+        }
+    }
+    fuse_reply_write(req, res);
+}
+
+auto release(const fuse_req_t req, const fuse_ino_t ino, fuse_file_info* const fi) -> void {
+    auto& handle = to_handle(fi);
+    if(handle.is_written()) {
+        // phantom files may have been regenerated while writing
+        if(const auto location = locate(ino); location && location->parent != 0) {
+            on_entry_changed(location->parent, location->name, true);
+        }
+    }
+    close_phantom_file(release_fh(fi));
+    fuse_reply_err(req, 0);
+}
+
+// the whole listing is read on open, so that offsets stay valid between readdir calls
+auto opendir(const fuse_req_t req, const fuse_ino_t ino, fuse_file_info* const fi) -> void {
+    const auto location = locate(ino);
+    if(!location) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+    const auto fd = openat(location->dir->as_handle(), location->name.data(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(fd == -1) {
+        fuse_reply_err(req, errno);
+        return;
+    }
+    const auto dir = fdopendir(fd);
+    if(dir == NULL) {
+        const auto error = errno;
+        ::close(fd);
+        fuse_reply_err(req, error);
+        return;
+    }
+
+    auto listing  = std::unique_ptr<DirListing>(new DirListing());
+    auto phantoms = std::vector<std::string>();
+    auto path     = options.prefetch > 0 ? get_path(*location) : std::nullopt;
+    auto de       = (dirent*)(nullptr);
+    while((de = ::readdir(dir)) != NULL) {
+        for(auto& file : to_phantom_paths(de->d_name)) {
+            if(path && file.view() != de->d_name) {
+                phantoms.emplace_back(*path + (path->back() == '/' ? "" : "/") + std::string(file.view()));
+            }
+            listing->push_back({std::string(file.view()), de->d_ino, mode_t(de->d_type << 12)});
+        }
+    }
+    closedir(dir);
+    if(path) {
+        record_listing(*path, std::move(phantoms));
+    }
+
+    fi->fh = reinterpret_cast<uintptr_t>(listing.get());
+    if(fuse_reply_open(req, fi) == 0) {
+        listing.release();
+    }
+}
+
+auto readdir(const fuse_req_t req, const fuse_ino_t /*ino*/, const size_t size, const off_t offset, fuse_file_info* const fi) -> void {
+    const auto& listing = *reinterpret_cast<DirListing*>(uintptr_t(fi->fh));
+
+    auto buf  = std::vector<char>(size);
+    auto used = size_t(0);
+    for(auto i = size_t(offset); i < listing.size(); i += 1) {
+        auto st    = Stat();
+        st.st_ino  = listing[i].ino;
+        st.st_mode = listing[i].type;
+
+        const auto entry_size = fuse_add_direntry(req, buf.data() + used, size - used, listing[i].name.data(), &st, i + 1);
+        if(entry_size > size - used) {
+            break;
+        }
+        used += entry_size;
+    }
+    fuse_reply_buf(req, buf.data(), used);
+}
+
+auto releasedir(const fuse_req_t req, const fuse_ino_t /*ino*/, fuse_file_info* const fi) -> void {
+    delete reinterpret_cast<DirListing*>(uintptr_t(fi->fh));
+    fuse_reply_err(req, 0);
+}
+
+auto statfs(const fuse_req_t req, const fuse_ino_t /*ino*/) -> void {
+    const auto dir = get_dir_fd(FUSE_ROOT_ID);
+    if(!dir) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+    auto st = Statvfs();
+    if(fstatvfs(dir->as_handle(), &st) == -1) {
+        fuse_reply_err(req, errno);
+        return;
+    }
+    fuse_reply_statfs(req, &st);
+}
+
+auto access(const fuse_req_t req, const fuse_ino_t ino, const int mask) -> void {
+    const auto location = locate(ino);
+    if(!location) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+    const auto name = get_real_name(*location);
+    const auto res  = faccessat(location->dir->as_handle(), name.data(), mask, 0);
+    fuse_reply_err(req, res == -1 ? errno : 0);
+}
+
+const auto operations = fuse_lowlevel_ops{
+    .init            = init,
+    .destroy         = destroy,
+    .lookup          = lookup,
+    .forget          = forget,
+    .getattr         = getattr,
+    .setattr         = setattr,
+    .readlink        = readlink,
+    .mknod           = mknod,
+    .mkdir           = mkdir,
+    .unlink          = unlink,
+    .rmdir           = rmdir,
+    .symlink         = symlink,
+    .rename          = rename,
+    .link            = link,
+    .open            = open,
+    .read            = read,
+    .write           = write,
+    .flush           = NULL,
+    .release         = release,
+    .fsync           = NULL,
+    .opendir         = opendir,
+    .readdir         = readdir,
+    .releasedir      = releasedir,
+    .fsyncdir        = NULL,
+    .statfs          = statfs,
+    .setxattr        = NULL,
+    .getxattr        = NULL,
+    .listxattr       = NULL,
+    .removexattr     = NULL,
+    .access          = access,
+    .create          = create,
+    .getlk           = NULL,
+    .setlk           = NULL,
+    .bmap            = NULL,
+    .ioctl           = NULL,
+    .poll            = NULL,
+    .write_buf       = NULL,
+    .retrieve_reply  = NULL,
+    .forget_multi    = forget_multi,
+    .flock           = NULL,
+    .fallocate       = NULL,
+    .readdirplus     = NULL,
+    .copy_file_range = NULL,
+    .lseek           = NULL,
+};
+
+auto run(fuse_args& args) -> int {
+    auto cmdline = fuse_cmdline_opts();
+    if(fuse_parse_cmdline(&args, &cmdline) != 0) {
+        return 1;
+    }
+    // same as fuse_main()
+    if(cmdline.show_help) {
+        std::cout << "usage: " << args.argv[0] << " [options] <mountpoint>\n\n";
+        std::cout << "FUSE options:" << std::endl;
+        fuse_cmdline_help();
+        fuse_lowlevel_help();
+        free(cmdline.mountpoint);
+        return 0;
+    }
+    if(cmdline.show_version) {
+        std::cout << "FUSE library version " << fuse_pkgversion() << std::endl;
+        fuse_lowlevel_version();
+        free(cmdline.mountpoint);
+        return 0;
+    }
+    if(cmdline.mountpoint == NULL) {
+        std::cerr << "no mountpoint given" << std::endl;
+        return 1;
+    }
+
+    auto root_fd = FileDescriptor(::open(root.data(), O_PATH | O_DIRECTORY | O_CLOEXEC));
+    if(!root_fd) {
+        std::cerr << "failed to open device dir \"" << root << "\"" << std::endl;
+        free(cmdline.mountpoint);
+        return 1;
+    }
+    {
+        auto [lock, inodes] = critical_inodes.access();
+        inodes.init(std::move(root_fd));
+    }
+
+    auto ret = 1;
+    session  = fuse_session_new(&args, &operations, sizeof(operations), NULL);
+    if(session == NULL) {
+        goto free_mountpoint;
+    }
+    if(fuse_set_signal_handlers(session) != 0) {
+        goto destroy_session;
+    }
+    if(fuse_session_mount(session, cmdline.mountpoint) != 0) {
+        goto remove_handlers;
+    }
+    fuse_daemonize(cmdline.foreground);
+    ret = cmdline.singlethread ? fuse_session_loop(session) : fuse_session_loop_mt(session, cmdline.clone_fd);
+    fuse_session_unmount(session);
+remove_handlers:
+    fuse_remove_signal_handlers(session);
+destroy_session:
+    fuse_session_destroy(session);
+free_mountpoint:
+    free(cmdline.mountpoint);
+    return ret == 0 ? 0 : 1;
+}
+} // namespace lowlevel
+
+auto process_option(void* const /*data*/, const char* const arg, const int key, fuse_args* const /*outargs*/) -> int {
+    if(key == FUSE_OPT_KEY_NONOPT) {
+        root = std::filesystem::absolute(arg).string() + ".dev";
+        if(!std::filesystem::is_directory(root)) {
+            std::cerr << "device dir \"" << root << "\" is not a directory";
+        }
+    }
+    return 1;
+}
+
+auto set_png_options(const drivers::jxl::PngOptions& png_options) -> void {
+    std::get<drivers::jxl::Driver>(drivers).set_png_options(png_options);
+}
+
+auto set_jpeg_options(const drivers::jxl::JpegOptions& jpeg_options) -> void {
+    std::get<drivers::jxl::Driver>(drivers).set_jpeg_options(jpeg_options);
+}
 } // namespace
 
 auto main(const int argc, char* argv[]) -> int {
-    for(auto i = 1; i < argc; i += 1) {
-        if(argv[i][0] != '-') {
-            root = std::filesystem::absolute(argv[i]).string() + ".dev";
-            if(!std::filesystem::is_directory(root)) {
-                std::cerr << "device dir \"" << root << "\" is not a directory";
+    auto args = fuse_args FUSE_ARGS_INIT(argc, argv);
+    if(fuse_opt_parse(&args, &options, option_spec.data(), process_option) == -1) {
+        return 1;
+    }
+
+    if(options.cache_size != NULL) {
+        const auto size = parse_size(options.cache_size);
+        if(!size) {
+            std::cerr << "invalid cache_size \"" << options.cache_size << "\"" << std::endl;
+            return 1;
+        }
+        decoded_cache.set_budget(size.value());
+    }
+
+    if(options.cache_dir != NULL) {
+        const auto size = parse_size(options.cache_dir_size != NULL ? options.cache_dir_size : "10G");
+        if(!size) {
+            std::cerr << "invalid cache_dir_size \"" << options.cache_dir_size << "\"" << std::endl;
+            return 1;
+        }
+        disk_cache.emplace(std::filesystem::absolute(options.cache_dir).string(), size.value());
+        if(!disk_cache->init()) {
+            std::cerr << "failed to initialize cache_dir \"" << options.cache_dir << "\"" << std::endl;
+            return 1;
+        }
+    }
+
+    if(options.jxl_threads >= 0) {
+        drivers::jxl::parallel_runner.set_threads(options.jxl_threads);
+    }
+
+    {
+        auto png_options = drivers::jxl::PngOptions{.parallel = bool(options.png_parallel)};
+        if(options.png_profile != NULL) {
+            const auto profile = drivers::jxl::parse_png_profile(options.png_profile);
+            if(!profile) {
+                std::cerr << "invalid png_profile \"" << options.png_profile << "\"" << std::endl;
+                return 1;
+            }
+            png_options.profile = profile.value();
+        }
+        set_png_options(png_options);
+    }
+
+    {
+        if(options.jpg_quality < 0 || options.jpg_quality > 100) {
+            std::cerr << "invalid jpg_quality " << options.jpg_quality << std::endl;
+            return 1;
+        }
+        auto jpeg_options = drivers::jxl::JpegOptions{
+            .quality     = options.jpg_quality,
+            .fast_dct    = bool(options.jpg_fast_dct),
+            .optimize    = bool(options.jpg_optimize),
+            .progressive = bool(options.jpg_progressive),
+        };
+        if(options.jpg_subsampling != NULL) {
+            const auto subsampling = drivers::jxl::parse_jpeg_subsampling(options.jpg_subsampling);
+            if(!subsampling) {
+                std::cerr << "invalid jpg_subsampling \"" << options.jpg_subsampling << "\"" << std::endl;
+                return 1;
             }
+            jpeg_options.subsampling = subsampling.value();
         }
+        set_jpeg_options(jpeg_options);
     }
 
-    return fuse_main(argc, argv, &operations, NULL);
+    const auto ret = options.lowlevel ? lowlevel::run(args) : fuse_main(args.argc, args.argv, &operations, NULL);
+    fuse_opt_free_args(&args);
+    return ret;
 }
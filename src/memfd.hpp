@@ -1,9 +1,11 @@
 #pragma once
+#include <bit>
+#include <cstddef>
 #include <memory>
-#include <mutex>
 #include <string_view>
 
 #include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "util/fd.hpp"
 
@@ -37,24 +39,42 @@ inline auto open_memory_fd(const char* const name) -> FileDescriptor {
     return FileDescriptor(memfd_create(name, 0));
 }
 
-inline auto reset_fd_cursor(const int fd) -> int {
-    if(lseek(fd, 0, SEEK_SET) == -1) {
-        return -1;
+// shared writable mapping of the first size bytes of fd
+class Mapping {
+  private:
+    std::byte* data = nullptr;
+    size_t     size = 0;
+
+  public:
+    auto get() const -> std::byte* {
+        return data;
     }
-    return fd;
-}
 
-inline auto get_fd_size(const int fd) -> ssize_t {
-    static auto mutex = std::mutex();
-    const auto  lock  = std::lock_guard(mutex); // block lseek for same fd at same time
-    const auto  size  = lseek(fd, 0, SEEK_END);
-    if(size == -1) {
-        goto error;
+    operator bool() const {
+        return data != nullptr;
+    }
+
+    Mapping(const int fd, const size_t size) {
+        const auto ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if(ptr == MAP_FAILED) {
+            return;
+        }
+        this->data = std::bit_cast<std::byte*>(ptr);
+        this->size = size;
     }
-    if(reset_fd_cursor(fd) == -1) {
-        goto error;
+
+    Mapping(const Mapping&)                    = delete;
+    auto operator=(const Mapping&) -> Mapping& = delete;
+
+    ~Mapping() {
+        if(data != nullptr) {
+            munmap(data, size);
+        }
     }
-    return size;
-error:
-    return -1;
+};
+
+// does not touch the file offset, so it is safe to call while others use the fd
+inline auto get_fd_size(const int fd) -> ssize_t {
+    struct stat st;
+    return fstat(fd, &st) == -1 ? -1 : st.st_size;
 }
@@ -0,0 +1,86 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <optional>
+#include <string_view>
+
+#include "fuse.hpp"
+#include "util/charconv.hpp"
+
+// mount options, given as "-o name=value"
+struct Options {
+    const char* cache_size       = NULL;  // decoded cache budget, e.g. "512M"
+    int         streaming        = false; // decode phantom files on read if the driver supports it
+    const char* cache_dir        = NULL;  // persistent cache of generated files
+    const char* cache_dir_size   = NULL;  // size limit of cache_dir
+    int         watch            = false; // watch source directories for changes made outside of the mount
+    double      entry_timeout    = 0;     // seconds the kernel may cache lookups
+    double      attr_timeout     = 0;     // seconds the kernel may cache attributes
+    double      negative_timeout = 0;     // seconds the kernel may cache failed lookups
+    int         prefetch         = 0;     // number of files decoded ahead of the last opened one
+    int         prefetch_threads = 1;
+    int         jxl_threads      = -1;    // workers shared by all jxl decodes, -1 means the number of cpus
+    const char* png_profile      = NULL;  // "fastest", "balanced" or "smallest"
+    int         png_parallel     = false; // compress png row strips on the jxl workers
+    int         jpg_quality      = 75;
+    const char* jpg_subsampling  = NULL;  // "444", "422" or "420"
+    int         jpg_fast_dct     = false; // faster but less accurate dct
+    int         jpg_optimize     = false; // smaller files at the cost of another pass
+    int         jpg_progressive  = false;
+    int         path_cache       = true;  // remember path resolutions while their directory is unchanged
+    int         lowlevel         = false; // use the low-level api, with an inode table instead of paths
+};
+
+inline const auto option_spec = std::array{
+    fuse_opt{"cache_size=%s", offsetof(Options, cache_size), 0},
+    fuse_opt{"streaming", offsetof(Options, streaming), true},
+    fuse_opt{"cache_dir=%s", offsetof(Options, cache_dir), 0},
+    fuse_opt{"cache_dir_size=%s", offsetof(Options, cache_dir_size), 0},
+    fuse_opt{"watch", offsetof(Options, watch), true},
+    fuse_opt{"entry_timeout=%lf", offsetof(Options, entry_timeout), 0},
+    fuse_opt{"attr_timeout=%lf", offsetof(Options, attr_timeout), 0},
+    fuse_opt{"negative_timeout=%lf", offsetof(Options, negative_timeout), 0},
+    fuse_opt{"prefetch=%d", offsetof(Options, prefetch), 0},
+    fuse_opt{"prefetch_threads=%d", offsetof(Options, prefetch_threads), 0},
+    fuse_opt{"jxl_threads=%d", offsetof(Options, jxl_threads), 0},
+    fuse_opt{"png_profile=%s", offsetof(Options, png_profile), 0},
+    fuse_opt{"png_parallel", offsetof(Options, png_parallel), true},
+    fuse_opt{"jpg_quality=%d", offsetof(Options, jpg_quality), 0},
+    fuse_opt{"jpg_subsampling=%s", offsetof(Options, jpg_subsampling), 0},
+    fuse_opt{"jpg_fast_dct", offsetof(Options, jpg_fast_dct), true},
+    fuse_opt{"jpg_optimize", offsetof(Options, jpg_optimize), true},
+    fuse_opt{"jpg_progressive", offsetof(Options, jpg_progressive), true},
+    fuse_opt{"path_cache", offsetof(Options, path_cache), true},
+    fuse_opt{"no_path_cache", offsetof(Options, path_cache), false},
+    fuse_opt{"lowlevel", offsetof(Options, lowlevel), true},
+    fuse_opt{NULL, 0, 0},
+};
+
+// "4096" -> 4096, "512K" -> 524288, "1G" -> 1073741824
+inline auto parse_size(std::string_view str) -> std::optional<size_t> {
+    auto unit = size_t(1);
+    if(!str.empty()) {
+        switch(str.back()) {
+        case 'K':
+        case 'k':
+            unit = size_t(1) << 10;
+            break;
+        case 'M':
+        case 'm':
+            unit = size_t(1) << 20;
+            break;
+        case 'G':
+        case 'g':
+            unit = size_t(1) << 30;
+            break;
+        }
+        if(unit != 1) {
+            str.remove_suffix(1);
+        }
+    }
+    const auto value = from_chars<size_t>(str);
+    if(!value) {
+        return std::nullopt;
+    }
+    return *value * unit;
+}
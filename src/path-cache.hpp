@@ -0,0 +1,82 @@
+#pragma once
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include <time.h>
+
+#include "util/string-map.hpp"
+
+// what a virtual path is backed by
+struct Resolution {
+    std::string           real;   // empty if the path does not exist
+    std::optional<size_t> driver; // index into Drivers, if the path is a phantom file
+};
+
+// remembers resolutions of virtual paths, including failed ones
+// entries of a directory are valid as long as its mtime is the same, since creating, removing or renaming a file in it changes the mtime
+class PathCache {
+  private:
+    struct Directory {
+        timespec              mtime;
+        StringMap<Resolution> entries;
+    };
+
+    constexpr static auto max_directories = size_t(1024);
+    constexpr static auto max_entries     = size_t(4096); // per directory
+
+    StringMap<Directory> directories;
+
+    static auto is_same(const timespec& a, const timespec& b) -> bool {
+        return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+    }
+
+    // timestamps are coarse, so a directory modified just now may be modified again without its mtime changing
+    static auto is_settled(const timespec& mtime) -> bool {
+        auto now = timespec();
+        clock_gettime(CLOCK_REALTIME, &now);
+        return now.tv_sec > mtime.tv_sec + 1;
+    }
+
+  public:
+    auto find(const std::string_view dir, const std::string_view name, const timespec& mtime) -> std::optional<Resolution> {
+        const auto p = directories.find(dir);
+        if(p == directories.end()) {
+            return std::nullopt;
+        }
+        if(!is_same(p->second.mtime, mtime)) {
+            directories.erase(p);
+            return std::nullopt;
+        }
+        const auto e = p->second.entries.find(name);
+        if(e == p->second.entries.end()) {
+            return std::nullopt;
+        }
+        return e->second;
+    }
+
+    // mtime must be taken before resolving
+    auto insert(const std::string_view dir, const std::string_view name, const timespec& mtime, Resolution resolution) -> void {
+        if(!is_settled(mtime)) {
+            return;
+        }
+        auto p = directories.find(dir);
+        if(p == directories.end() || !is_same(p->second.mtime, mtime)) {
+            if(directories.size() >= max_directories) {
+                directories.clear();
+            }
+            p = directories.insert_or_assign(std::string(dir), Directory{mtime, {}}).first;
+        }
+        auto& entries = p->second.entries;
+        if(entries.size() >= max_entries) {
+            entries.clear();
+        }
+        entries.insert_or_assign(std::string(name), std::move(resolution));
+    }
+
+    auto erase(const std::string_view dir) -> void {
+        if(const auto p = directories.find(dir); p != directories.end()) {
+            directories.erase(p);
+        }
+    }
+};
@@ -0,0 +1,44 @@
+#pragma once
+#include <atomic>
+#include <ostream>
+
+// counters reported when the filesystem is unmounted
+struct Stats {
+    std::atomic_size_t decodes;
+    std::atomic_size_t coalesced_decodes; // opens which waited for a decode started by another thread
+    std::atomic_size_t disk_cache_hits;
+    std::atomic_size_t disk_cache_stores;
+    std::atomic_size_t prefetches;     // files decoded ahead by the prefetcher
+    std::atomic_size_t shared_streams; // stream opens which joined a stream of another open
+    std::atomic_size_t stream_stores;  // completed streams moved into the decoded cache
+    std::atomic_size_t zero_copy_reads; // read_buf replies backed by fd
+    std::atomic_size_t copied_reads;    // read_buf replies backed by memory
+    std::atomic_size_t read_bytes;
+    std::atomic_size_t png_chunks; // pieces of output handed out by libpng
+    std::atomic_size_t png_writes; // write() calls of png encoders
+    std::atomic_size_t path_lookups;
+    std::atomic_size_t path_cache_hits;    // lookups which did not probe the drivers
+    std::atomic_size_t cache_lock_waits;   // decoded cache accesses which found their shard locked
+    std::atomic_size_t cache_lock_wait_us; // total time spent waiting for them
+};
+
+inline auto stats = Stats();
+
+inline auto print_stats(std::ostream& os) -> void {
+    os << "decodes: " << stats.decodes << "\n"
+       << "coalesced decodes: " << stats.coalesced_decodes << "\n"
+       << "disk cache hits: " << stats.disk_cache_hits << "\n"
+       << "disk cache stores: " << stats.disk_cache_stores << "\n"
+       << "prefetches: " << stats.prefetches << "\n"
+       << "shared streams: " << stats.shared_streams << "\n"
+       << "stream stores: " << stats.stream_stores << "\n"
+       << "zero-copy reads: " << stats.zero_copy_reads << "\n"
+       << "copied reads: " << stats.copied_reads << "\n"
+       << "read bytes: " << stats.read_bytes << "\n"
+       << "png chunks: " << stats.png_chunks << "\n"
+       << "png writes: " << stats.png_writes << "\n"
+       << "path lookups: " << stats.path_lookups << "\n"
+       << "path cache hits: " << stats.path_cache_hits << "\n"
+       << "cache lock waits: " << stats.cache_lock_waits << "\n"
+       << "cache lock wait: " << stats.cache_lock_wait_us << "us\n";
+}
@@ -0,0 +1,77 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+// fixed number of workers running queued jobs in fifo order
+// workers may be niced, so that background jobs do not slow down foreground requests
+class ThreadPool {
+  public:
+    using Job = std::function<void()>;
+
+  private:
+    std::vector<std::thread> workers;
+    std::mutex               mutex;
+    std::condition_variable  condv;
+    std::deque<Job>          jobs;
+    bool                     exiting = false;
+
+    auto run(const int nice) -> void {
+        if(nice != 0) {
+            // linux applies PRIO_PROCESS with a thread id to that thread only
+            setpriority(PRIO_PROCESS, gettid(), nice);
+        }
+        while(true) {
+            auto job = Job();
+            {
+                auto lock = std::unique_lock(mutex);
+                condv.wait(lock, [this]() { return exiting || !jobs.empty(); });
+                if(exiting) {
+                    return;
+                }
+                job = std::move(jobs.front());
+                jobs.pop_front();
+            }
+            job();
+        }
+    }
+
+  public:
+    auto push(Job job) -> void {
+        {
+            const auto lock = std::lock_guard(mutex);
+            jobs.emplace_back(std::move(job));
+        }
+        condv.notify_one();
+    }
+
+    auto start(const size_t count, const int nice = 0) -> void {
+        for(auto i = size_t(0); i < count; i += 1) {
+            workers.emplace_back(&ThreadPool::run, this, nice);
+        }
+    }
+
+    // queued jobs are discarded
+    auto stop() -> void {
+        {
+            const auto lock = std::lock_guard(mutex);
+            exiting         = true;
+            jobs.clear();
+        }
+        condv.notify_all();
+        for(auto& worker : workers) {
+            worker.join();
+        }
+        workers.clear();
+    }
+
+    ~ThreadPool() {
+        stop();
+    }
+};
@@ -0,0 +1,117 @@
+#pragma once
+#include <array>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "util/fd.hpp"
+#include "util/thread.hpp"
+
+// reports files modified in watched directories, including changes made outside of the mount
+class Watcher {
+  public:
+    using Callback = std::function<void(std::string_view path)>;
+
+  private:
+    constexpr static auto mask = IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE | IN_ATTRIB;
+
+    FileDescriptor inotify;
+    FileDescriptor stop_event;
+    std::thread    thread;
+    Callback       callback;
+
+    Critical<std::unordered_map<int, std::string>> critical_dirs; // watch descriptor -> directory
+
+    auto handle_event(const inotify_event& event) -> void {
+        auto path = std::string();
+        {
+            auto [lock, dirs] = critical_dirs.access();
+            const auto p      = dirs.find(event.wd);
+            if(p == dirs.end()) {
+                return;
+            }
+            if(event.mask & IN_IGNORED) {
+                dirs.erase(p);
+                return;
+            }
+            if(event.len == 0) {
+                return;
+            }
+            path = p->second + "/" + event.name;
+        }
+        callback(path);
+    }
+
+    auto run() -> void {
+        alignas(inotify_event) auto buffer = std::array<char, 4096>();
+
+        auto fds = std::array{
+            pollfd{.fd = inotify.as_handle(), .events = POLLIN, .revents = 0},
+            pollfd{.fd = stop_event.as_handle(), .events = POLLIN, .revents = 0},
+        };
+        while(true) {
+            if(poll(fds.data(), fds.size(), -1) == -1) {
+                if(errno == EINTR) {
+                    continue;
+                }
+                return;
+            }
+            if(fds[1].revents != 0) {
+                return;
+            }
+
+            const auto len = ::read(inotify.as_handle(), buffer.data(), buffer.size());
+            if(len <= 0) {
+                continue;
+            }
+            for(auto p = buffer.data(); p < buffer.data() + len;) {
+                const auto& event = *std::bit_cast<const inotify_event*>(p);
+                handle_event(event);
+                p += sizeof(inotify_event) + event.len;
+            }
+        }
+    }
+
+  public:
+    // watching the same directory again is harmless
+    auto watch(const std::string_view dir) -> void {
+        auto       dir_str = std::string(dir);
+        const auto wd      = inotify_add_watch(inotify.as_handle(), dir_str.data(), mask);
+        if(wd == -1) {
+            return;
+        }
+        auto [lock, dirs] = critical_dirs.access();
+        dirs.insert_or_assign(wd, std::move(dir_str));
+    }
+
+    auto start(Callback callback) -> bool {
+        inotify    = FileDescriptor(inotify_init1(IN_CLOEXEC));
+        stop_event = FileDescriptor(eventfd(0, EFD_CLOEXEC));
+        if(!inotify || !stop_event) {
+            return false;
+        }
+        this->callback = std::move(callback);
+        thread         = std::thread(&Watcher::run, this);
+        return true;
+    }
+
+    auto stop() -> void {
+        if(!thread.joinable()) {
+            return;
+        }
+        const auto                  value   = uint64_t(1);
+        [[maybe_unused]] const auto written = ::write(stop_event.as_handle(), &value, sizeof(value));
+        thread.join();
+    }
+
+    ~Watcher() {
+        stop();
+    }
+};